@@ -1,6 +1,10 @@
 #include "disassembler.h"
 #include <capstone/capstone.h>
 #include <mutex>
+#include <set>
+#include <vector>
+#include <cstdlib>
+#include <cctype>
 #include "log.h"
 
 namespace ext {
@@ -33,4 +37,162 @@ bool IsCodeExit(const std::string& mnemonic, const std::string& op)
     return false;
 }
 
+static std::string StripWidth(const std::string& mnemonic)
+{
+    if (mnemonic.size() > 2 && (mnemonic.compare(mnemonic.size() - 2, 2, ".w") == 0 || mnemonic.compare(mnemonic.size() - 2, 2, ".n") == 0)) {
+        return mnemonic.substr(0, mnemonic.size() - 2);
+    }
+    return mnemonic;
+}
+
+static bool IsRegister(const std::string& token)
+{
+    static const std::set<std::string> aliases = {"sb", "sl", "fp", "ip", "sp", "lr", "pc"};
+    if (token.size() >= 2 && token[0] == 'r' && isdigit(token[1])) {
+        return true;
+    }
+    return aliases.count(token) > 0;
+}
+
+static std::vector<std::string> SplitOperands(const std::string& op)
+{
+    std::vector<std::string> operands;
+    std::string current;
+    for (char c : op) {
+        if (c == ',') {
+            operands.push_back(current);
+            current.clear();
+        } else if (c != ' ' && c != '[' && c != ']') {
+            current += c;
+        }
+    }
+    if (!current.empty()) {
+        operands.push_back(current);
+    }
+    return operands;
+}
+
+struct LoopInstruction {
+    std::string dest;
+    std::vector<std::string> reads;
+};
+
+/*
+ * Classify one instruction of a candidate polling loop, returns false for
+ * anything with side effects (stores, calls, writeback).
+ */
+static bool DecodeLoopInstruction(const std::string& mnemonic, const std::string& op, LoopInstruction& insn)
+{
+    static const std::set<std::string> loads = {"ldr", "ldrb", "ldrh", "ldrsb", "ldrsh"};
+    static const std::set<std::string> compares = {"cmp", "cmn", "tst", "teq"};
+    static const std::set<std::string> moves = {"mov", "movs", "movw", "mvn", "mvns", "uxtb", "uxth", "sxtb", "sxth", "ubfx", "sbfx"};
+    static const std::set<std::string> alu = {"add", "adds", "sub", "subs", "rsb", "rsbs", "and", "ands", "orr", "orrs", "eor", "eors", "bic", "bics", "lsl", "lsls", "lsr", "lsrs", "asr", "asrs", "movt"};
+
+    auto name = StripWidth(mnemonic);
+    auto operands = SplitOperands(op);
+    if (operands.empty()) {
+        return false;
+    }
+    if (loads.count(name)) {
+        /* writeback or post-indexed addressing changes the base every iteration */
+        if (op.find('!') != std::string::npos || op.find("],") != std::string::npos) {
+            return false;
+        }
+        insn.dest = operands[0];
+        operands.erase(operands.begin());
+    } else if (compares.count(name)) {
+    } else if (moves.count(name) || alu.count(name)) {
+        insn.dest = operands[0];
+        /* two operand forms (adds r0, #1) and movt also read the destination */
+        if (name == "movt" || (alu.count(name) && operands.size() == 2)) {
+            insn.reads.push_back(operands[0]);
+        }
+        operands.erase(operands.begin());
+    } else {
+        return false;
+    }
+    for (const auto& operand : operands) {
+        if (IsRegister(operand)) {
+            insn.reads.push_back(operand);
+        }
+    }
+    return true;
+}
+
+static bool IsLocalBranch(const std::string& mnemonic, bool& conditional)
+{
+    static const std::set<std::string> conditions = {"eq", "ne", "cs", "hs", "cc", "lo", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le"};
+    auto name = StripWidth(mnemonic);
+    if (name == "b") {
+        conditional = false;
+        return true;
+    } else if (name == "cbz" || name == "cbnz") {
+        conditional = true;
+        return true;
+    } else if (name.size() == 3 && name[0] == 'b' && conditions.count(name.substr(1))) {
+        conditional = true;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * A polling loop only loads, tests and branches back to its own start, and
+ * every register it reads is either loop invariant or recomputed from a load
+ * earlier in the same iteration. Spinning in it cannot make progress until
+ * memory is changed by somebody else (an interrupt, usually).
+ */
+bool IsPollingLoop(const uint8_t* code, uint32_t address, size_t size)
+{
+    std::vector<LoopInstruction> body;
+    bool valid = true;
+    bool closed = false;
+    bool hasLoad = false;
+    DisassembleIter(code, address, size, [&](uint32_t addr, const std::string& mnemonic, const std::string& op) {
+        if (!valid || closed) {
+            return;
+        }
+        bool conditional = false;
+        if (IsLocalBranch(mnemonic, conditional)) {
+            auto pos = op.rfind('#');
+            uint32_t target = pos == std::string::npos ? 0 : strtoul(op.c_str() + pos + 1, nullptr, 0);
+            if (target == address) {
+                closed = true;
+            } else if (!conditional || target < addr) {
+                valid = false;
+            }
+            return;
+        }
+        LoopInstruction insn;
+        if (!DecodeLoopInstruction(mnemonic, op, insn)) {
+            valid = false;
+            return;
+        }
+        hasLoad = hasLoad || StripWidth(mnemonic).compare(0, 2, "ld") == 0;
+        body.push_back(insn);
+    });
+    if (!valid || !closed || !hasLoad) {
+        return false;
+    }
+
+    std::set<std::string> writtenInLoop;
+    for (const auto& insn : body) {
+        if (!insn.dest.empty()) {
+            writtenInLoop.insert(insn.dest);
+        }
+    }
+    std::set<std::string> written;
+    for (const auto& insn : body) {
+        for (const auto& reg : insn.reads) {
+            if (writtenInLoop.count(reg) && !written.count(reg)) {
+                return false; // loop carried value, e.g. a countdown
+            }
+        }
+        if (!insn.dest.empty()) {
+            written.insert(insn.dest);
+        }
+    }
+    return true;
+}
+
 } // namespace ext
@@ -7,5 +7,6 @@ namespace ext {
 
 void DisassembleIter(const uint8_t* code, uint32_t address, size_t size, std::function<void(uint32_t, const std::string&, const std::string&)> callback);
 bool IsCodeExit(const std::string&, const std::string&);
+bool IsPollingLoop(const uint8_t* code, uint32_t address, size_t size);
 
 } // namespace ext
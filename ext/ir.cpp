@@ -20,6 +20,13 @@ U64::U64(Dynarmic::A32::IREmitter& ir, Reg reg)
     opaque = std::make_shared<Dynarmic::IR::U64>(ir.ZeroExtendWordToLong(v));
 }
 
+U64::U64(Dynarmic::A32::IREmitter& ir, Reg low, Reg high)
+{
+    auto lo = ir.GetRegister((Dynarmic::A32::Reg)low);
+    auto hi = ir.GetRegister((Dynarmic::A32::Reg)high);
+    opaque = std::make_shared<Dynarmic::IR::U64>(ir.Pack2x32To1x64(lo, hi));
+}
+
 #define SELF (*((Dynarmic::IR::U64*)opaque.get()))
 #define OPAQUE(x) (*((Dynarmic::IR::U64*)x.opaque.get()))
 
@@ -44,4 +51,16 @@ void SetRegister(Dynarmic::A32::IREmitter& ir, Reg reg, std::uint32_t value)
     ir.SetRegister((Dynarmic::A32::Reg)reg, v);
 }
 
+void LoadRegister(Dynarmic::A32::IREmitter& ir, Reg reg, std::uint32_t addr)
+{
+    auto v = ir.ReadMemory32(ir.Imm32(addr), Dynarmic::IR::AccType::NORMAL);
+    ir.SetRegister((Dynarmic::A32::Reg)reg, v);
+}
+
+void StoreRegister(Dynarmic::A32::IREmitter& ir, Reg reg, std::uint32_t addr)
+{
+    auto v = ir.GetRegister((Dynarmic::A32::Reg)reg);
+    ir.WriteMemory32(ir.Imm32(addr), v, Dynarmic::IR::AccType::NORMAL);
+}
+
 } // namespace ext
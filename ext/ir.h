@@ -23,6 +23,7 @@ struct U64 {
     U64();
     U64(std::uint64_t imm);
     U64(Dynarmic::A32::IREmitter& ir, Reg reg);
+    U64(Dynarmic::A32::IREmitter& ir, Reg low, Reg high);
 
     std::shared_ptr<void> opaque;
 };
@@ -31,5 +32,7 @@ void CallHostFunction(Dynarmic::A32::IREmitter& ir, void (*fn)(std::uint64_t), c
 void CallHostFunction(Dynarmic::A32::IREmitter& ir, void (*fn)(std::uint64_t, std::uint64_t), const U64& arg1, const U64& arg2);
 void CallHostFunction(Dynarmic::A32::IREmitter& ir, void (*fn)(std::uint64_t, std::uint64_t, std::uint64_t), const U64& arg1, const U64& arg2, const U64& arg3);
 void SetRegister(Dynarmic::A32::IREmitter& ir, Reg reg, std::uint32_t value);
+void LoadRegister(Dynarmic::A32::IREmitter& ir, Reg reg, std::uint32_t addr);
+void StoreRegister(Dynarmic::A32::IREmitter& ir, Reg reg, std::uint32_t addr);
 
 } // namespace ext
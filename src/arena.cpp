@@ -0,0 +1,49 @@
+#include "arena.h"
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <ext/log.h>
+
+namespace m8 {
+
+MemoryArena::MemoryArena()
+{
+    void* ptr = mmap(nullptr, ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        ext::LogError("MemoryArena: failed to reserve guest address space: %s", strerror(errno));
+        std::terminate();
+    }
+    base = (u8*)ptr;
+}
+
+MemoryArena::~MemoryArena()
+{
+    if (base) {
+        munmap(base, ARENA_SIZE);
+    }
+}
+
+u8* MemoryArena::Map(u32 addr, u32 size)
+{
+    /* pages outside mapped regions stay PROT_NONE, so fastmem faults fall back to the callbacks */
+    u8* ptr = base + addr;
+    if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0) {
+        ext::LogError("MemoryArena: failed to map 0x%x (size 0x%x): %s", addr, size, strerror(errno));
+        std::terminate();
+    }
+    return ptr;
+}
+
+u8* MemoryArena::MapShared(u32 addr, u32 size, int fd)
+{
+    /* read-only view of memory shared with other instances, replaces whatever was mapped there */
+    void* ptr = mmap(base + addr, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        ext::LogError("MemoryArena: failed to map shared 0x%x (size 0x%x): %s", addr, size, strerror(errno));
+        std::terminate();
+    }
+    return (u8*)ptr;
+}
+
+} // namespace m8
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+#include <cstddef>
+
+namespace m8 {
+
+/* Reserves the whole 32-bit guest address space in the host so RAM can be reached with a single base offset */
+class MemoryArena {
+public:
+    static constexpr std::size_t ARENA_SIZE = 1ULL << 32;
+
+    MemoryArena();
+    ~MemoryArena();
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    u8* Map(u32 addr, u32 size);
+    u8* MapShared(u32 addr, u32 size, int fd);
+    u8* Base() { return base; }
+
+private:
+    u8* base = nullptr;
+};
+
+} // namespace m8
@@ -0,0 +1,55 @@
+#include "audioclock.h"
+#include <cmath>
+#include <algorithm>
+
+#define CLOCK_FILL_SMOOTHING 0.0625 // the fill jumps by a block on every push and a packet on every read
+#define CLOCK_KP             1e-5   // period change per microsecond of latency error
+#define CLOCK_KI             1e-7   // per cycle
+#define CLOCK_MAX_ADJUST     0.01   // +-1 %, far beyond any real crystal drift
+
+namespace m8 {
+
+AudioClock::AudioClock(u32 sampleRate, u32 blockSamples, u32 frameBytes)
+{
+    nominal = 1e6 * blockSamples / sampleRate;
+    bytesPerMicrosecond = (double)sampleRate * frameBytes / 1e6;
+    SetTargetLatency(std::chrono::microseconds((u64)(nominal * 8)));
+}
+
+void AudioClock::SetTargetLatency(std::chrono::microseconds latency)
+{
+    target = latency.count() * bytesPerMicrosecond;
+    Reset();
+}
+
+std::chrono::microseconds AudioClock::Nominal() const
+{
+    return std::chrono::microseconds((u64)nominal);
+}
+
+void AudioClock::Reset()
+{
+    fill = -1;
+    integral = 0;
+    ratio = 1;
+}
+
+std::chrono::microseconds AudioClock::Update(const StreamLevel& level)
+{
+    /* nobody reading: run free at the nominal rate instead of winding up the integrator */
+    if (level.consumed == lastConsumed) {
+        Reset();
+    } else {
+        lastConsumed = level.consumed;
+        fill = fill < 0 ? level.buffered : fill + (level.buffered - fill) * CLOCK_FILL_SMOOTHING;
+        double error = (fill - Target()) / bytesPerMicrosecond;
+        integral = std::clamp(integral + error * CLOCK_KI, -CLOCK_MAX_ADJUST, CLOCK_MAX_ADJUST);
+        ratio = 1 + std::clamp(error * CLOCK_KP + integral, -CLOCK_MAX_ADJUST, CLOCK_MAX_ADJUST);
+    }
+    double period = nominal * ratio + carry;
+    double whole = std::floor(period);
+    carry = period - whole;
+    return std::chrono::microseconds((u64)whole);
+}
+
+} // namespace m8
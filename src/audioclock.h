@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+#include <chrono>
+
+namespace m8 {
+
+/* fill state of a stream endpoint ring, in bytes */
+struct StreamLevel {
+    std::size_t buffered = 0;
+    std::size_t capacity = 0;
+    u64 consumed = 0;
+    u64 dropped = 0;   // truncated by a full ring
+    u64 underruns = 0; // reads that found the ring empty once streaming started
+};
+
+/*
+ * Graph clock locked to the USB reader: a PI loop on the smoothed ring fill
+ * stretches or shortens the processing period around the nominal block
+ * duration so the buffered audio stays at the target latency. Fractional
+ * microseconds are carried over, the timer only has 1 us resolution.
+ */
+class AudioClock {
+public:
+    AudioClock(u32 sampleRate, u32 blockSamples, u32 frameBytes);
+
+    void SetTargetLatency(std::chrono::microseconds latency);
+    /* extra bytes held on top of the target, moved without resetting the loop */
+    void SetHeadroom(double bytes) { headroom = bytes; }
+    std::chrono::microseconds Nominal() const;
+    std::chrono::microseconds Update(const StreamLevel& level);
+
+    /* period / nominal period, above 1 when the reader is slower than us */
+    double Ratio() const { return ratio; }
+    double Fill() const { return fill; }
+    double Target() const { return target + headroom; }
+
+private:
+    void Reset();
+
+    double nominal;
+    double bytesPerMicrosecond;
+    double target = 0;
+    double headroom = 0;
+    double fill = -1;
+    double integral = 0;
+    double ratio = 1;
+    double carry = 0;
+    u64 lastConsumed = 0;
+};
+
+} // namespace m8
@@ -5,12 +5,6 @@
 
 namespace m8 {
 
-FirmwareConfig& FirmwareConfig::GlobalConfig()
-{
-    static FirmwareConfig& config = *new FirmwareConfig();
-    return config;
-}
-
 FirmwareConfig::FirmwareConfig()
 {
     config = std::make_shared<YAML::Node>();
@@ -24,13 +18,16 @@ bool FirmwareConfig::LoadConfig(const std::string& path, const std::string& firm
     } else {
         *config = YAML::LoadFile(path);
     }
-    // TODO: Add hash check here
     std::string firmware_name = std::filesystem::path(firmware).filename();
     if (!(*config)[firmware_name]) {
         ext::LogError("Failed to parse firmware %s", firmware_name.c_str());
         return false;
     }
     *config = (*config)[firmware_name];
+    /* checked by the loader against the HEX it reads */
+    if ((*config)["md5sum"]) {
+        md5sum = (*config)["md5sum"].as<std::string>();
+    }
 
     for (const auto& symbol : (*config)["symbols"]) {
         const auto& name = symbol.first.as<std::string>();
@@ -44,21 +41,45 @@ bool FirmwareConfig::LoadConfig(const std::string& path, const std::string& firm
     return true;
 }
 
-template<class T> T FirmwareConfig::GetValue(const std::string& key)
+/* lookups are const so emulator instances can share one config across threads */
+template<class T> T FirmwareConfig::GetValue(const std::string& key) const
 {
-    return (*config)["configs"][key].as<T>();
+    const YAML::Node& node = *config;
+    return node["configs"][key].as<T>();
 }
 
-template u32 FirmwareConfig::GetValue<u32>(const std::string& key);
+template u32 FirmwareConfig::GetValue<u32>(const std::string& key) const;
+
+bool FirmwareConfig::HasValue(const std::string& key) const
+{
+    const YAML::Node& node = *config;
+    return node["configs"][key].IsDefined();
+}
+
+/* optional sequence under configs, empty when missing */
+std::vector<u32> FirmwareConfig::GetValueList(const std::string& key) const
+{
+    const YAML::Node& node = *config;
+    std::vector<u32> values;
+    const auto& list = node["configs"][key];
+    if (list && list.IsSequence()) {
+        for (const auto& value : list) {
+            values.push_back(value.as<u32>());
+        }
+    }
+    return values;
+}
 
-u32 FirmwareConfig::GetSymbolAddress(const std::string& symbol)
+u32 FirmwareConfig::GetSymbolAddress(const std::string& symbol) const
 {
-    return symbols[symbol];
+    auto iter = symbols.find(symbol);
+    return iter != symbols.end() ? iter->second : 0;
 }
 
-std::tuple<u32, u32> FirmwareConfig::GetEntryRange(const std::string& entry)
+std::tuple<u32, u32> FirmwareConfig::GetEntryRange(const std::string& entry) const
 {
-    return ranges[entry];
+    auto iter = ranges.find(entry);
+    return iter != ranges.end() ? iter->second : std::tuple<u32, u32>{0, 0};
 }
 
 } // namespace m8
@@ -5,6 +5,7 @@
 #include <map>
 #include <tuple>
 #include <memory>
+#include <vector>
 
 namespace YAML {
 class Node;
@@ -14,17 +15,19 @@ namespace m8 {
 
 class FirmwareConfig {
 public:
-    static FirmwareConfig& GlobalConfig();
+    FirmwareConfig();
     bool LoadConfig(const std::string& path, const std::string& firmware);
-    template<class T> T GetValue(const std::string& key);
-    u32 GetSymbolAddress(const std::string& symbol);
-    std::tuple<u32, u32> GetEntryRange(const std::string& entry);
+    template<class T> T GetValue(const std::string& key) const;
+    bool HasValue(const std::string& key) const;
+    std::vector<u32> GetValueList(const std::string& key) const;
+    u32 GetSymbolAddress(const std::string& symbol) const;
+    std::tuple<u32, u32> GetEntryRange(const std::string& entry) const;
+    const std::string& GetMD5Sum() const { return md5sum; }
 
 private:
-    FirmwareConfig();
-
     std::map<std::string, u32> symbols;
     std::map<std::string, std::tuple<u32, u32>> ranges;
+    std::string md5sum;
 
     std::shared_ptr<YAML::Node> config;
 };
@@ -0,0 +1,49 @@
+#include "dispatch.h"
+#include <cstdlib>
+#include <new>
+#include <ext/log.h>
+
+namespace m8 {
+
+MemoryDispatcher::MemoryDispatcher() : pages((Page*)std::calloc(NUM_PAGES, sizeof(Page)), std::free)
+{
+    if (!pages) {
+        throw std::bad_alloc();
+    }
+}
+
+void MemoryDispatcher::MapDevice(Device* dev)
+{
+    for (u64 page = dev->BaseAddress() >> PAGE_BITS; page <= (dev->EndAddress() >> PAGE_BITS); page++) {
+        if (pages[page].device && pages[page].device != dev) {
+            ext::LogWarn("MemoryDispatcher: page 0x%x is shared by multiple devices", (u32)(page << PAGE_BITS));
+        }
+        pages[page].device = dev;
+    }
+}
+
+MemoryDispatcher::PageHooks& MemoryDispatcher::GetPageHooks(u32 addr)
+{
+    Page& page = pages[addr >> PAGE_BITS];
+    if (!page.hooks) {
+        hookStorage.push_back(std::make_unique<PageHooks>());
+        page.hooks = hookStorage.back().get();
+    }
+    return *page.hooks;
+}
+
+void MemoryDispatcher::AddReadHook(u32 addr, ReadHook hook)
+{
+    auto& hooks = GetPageHooks(addr);
+    hooks.readHooks[addr] = hook;
+    hooks.readMask.set(WordIndex(addr));
+}
+
+void MemoryDispatcher::AddWriteHook(u32 addr, WriteHook hook)
+{
+    auto& hooks = GetPageHooks(addr);
+    hooks.writeHooks[addr] = hook;
+    hooks.writeMask.set(WordIndex(addr));
+}
+
+} // namespace m8
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "io.h"
+#include <bitset>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+namespace m8 {
+
+using ReadHook = std::function<u32(u32)>;
+using WriteHook = std::function<void(u32, u32)>;
+
+/* Resolves a guest address to its device and word hooks with one page lookup */
+class MemoryDispatcher {
+public:
+    static constexpr u32 PAGE_BITS = Dynarmic::A32::UserConfig::PAGE_BITS;
+    static constexpr u32 PAGE_SIZE = 1 << PAGE_BITS;
+    static constexpr u32 PAGE_WORDS = PAGE_SIZE / sizeof(u32);
+    static constexpr u32 NUM_PAGES = Dynarmic::A32::UserConfig::NUM_PAGE_TABLE_ENTRIES;
+
+    MemoryDispatcher();
+
+    void MapDevice(Device* dev);
+    void AddReadHook(u32 addr, ReadHook hook);
+    void AddWriteHook(u32 addr, WriteHook hook);
+
+    Device* FindDevice(u32 addr) const { return pages[addr >> PAGE_BITS].device; }
+
+    const ReadHook* FindReadHook(u32 addr) const
+    {
+        const PageHooks* hooks = pages[addr >> PAGE_BITS].hooks;
+        if (hooks && hooks->readMask.test(WordIndex(addr))) {
+            auto iter = hooks->readHooks.find(addr);
+            if (iter != hooks->readHooks.end()) {
+                return &iter->second;
+            }
+        }
+        return nullptr;
+    }
+
+    const WriteHook* FindWriteHook(u32 addr) const
+    {
+        const PageHooks* hooks = pages[addr >> PAGE_BITS].hooks;
+        if (hooks && hooks->writeMask.test(WordIndex(addr))) {
+            auto iter = hooks->writeHooks.find(addr);
+            if (iter != hooks->writeHooks.end()) {
+                return &iter->second;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    struct PageHooks {
+        std::bitset<PAGE_WORDS> readMask;
+        std::bitset<PAGE_WORDS> writeMask;
+        std::unordered_map<u32, ReadHook> readHooks;
+        std::unordered_map<u32, WriteHook> writeHooks;
+    };
+
+    struct Page {
+        Device* device;
+        PageHooks* hooks;
+    };
+
+    static u32 WordIndex(u32 addr) { return (addr & (PAGE_SIZE - 1)) / sizeof(u32); }
+    PageHooks& GetPageHooks(u32 addr);
+
+    /* calloc'd so untouched pages stay lazily zero-filled by the host */
+    std::unique_ptr<Page[], void (*)(void*)> pages;
+    std::vector<std::unique_ptr<PageHooks>> hookStorage;
+};
+
+} // namespace m8
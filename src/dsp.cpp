@@ -0,0 +1,478 @@
+#include "dsp.h"
+#include "hle.h"
+#include <cstring>
+#include <ext/log.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_X86 1
+#endif
+
+namespace m8 {
+
+using std::int8_t;
+using std::int16_t;
+using std::int32_t;
+using std::int64_t;
+
+static int16_t Saturate16(int32_t value)
+{
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+}
+
+static int32_t Saturate32(int64_t value)
+{
+    return value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : value;
+}
+
+static void AddQ15Scalar(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate16(a[i] + b[i]);
+    }
+}
+
+static void SubQ15Scalar(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate16(a[i] - b[i]);
+    }
+}
+
+static void MultQ15Scalar(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate16((a[i] * b[i]) >> 15);
+    }
+}
+
+/* shift in [-16, 15], others are left to the firmware code */
+static void ScaleQ15Scalar(const int16_t* src, int16_t scale, int8_t shift, int16_t* dst, std::size_t count)
+{
+    int kShift = 15 - shift;
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate16((src[i] * scale) >> kShift);
+    }
+}
+
+static void AddQ31Scalar(const int32_t* a, const int32_t* b, int32_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate32((int64_t)a[i] + b[i]);
+    }
+}
+
+/* arm_scale_q31: the high word of the product, then a saturating left or a plain right shift by shift + 1, |shift + 1| < 32 */
+static void ScaleQ31Scalar(const int32_t* src, int32_t scale, int8_t shift, int32_t* dst, std::size_t count)
+{
+    int8_t kShift = shift + 1;
+    for (std::size_t i = 0; i < count; i++) {
+        int32_t in = ((int64_t)src[i] * scale) >> 32;
+        if (kShift >= 0) {
+            int32_t out = (u32)in << kShift;
+            dst[i] = in != (out >> kShift) ? 0x7FFFFFFF ^ (in >> 31) : out;
+        } else {
+            dst[i] = in >> -kShift;
+        }
+    }
+}
+
+static void GainQ15Scalar(const int16_t* src, int32_t mult, int16_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate16(((int64_t)mult * src[i]) >> 16);
+    }
+}
+
+static void GainAddQ15Scalar(const int16_t* src, int32_t mult, int16_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i] = Saturate16(dst[i] + Saturate16(((int64_t)mult * src[i]) >> 16));
+    }
+}
+
+static void InterleaveQ15Scalar(const int16_t* left, const int16_t* right, int16_t* dst, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dst[i * 2] = left[i];
+        dst[i * 2 + 1] = right[i];
+    }
+}
+
+#ifdef DSP_X86
+
+static void AddQ15SSE2(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epi16(va, vb));
+    }
+    AddQ15Scalar(a + i, b + i, dst + i, count - i);
+}
+
+static void SubQ15SSE2(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_subs_epi16(va, vb));
+    }
+    SubQ15Scalar(a + i, b + i, dst + i, count - i);
+}
+
+/* full 32 bit products from mullo/mulhi, shifted and packed back with signed saturation */
+static void MultQ15SSE2(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i lo = _mm_mullo_epi16(va, vb);
+        __m128i hi = _mm_mulhi_epi16(va, vb);
+        __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+        __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(p0, p1));
+    }
+    MultQ15Scalar(a + i, b + i, dst + i, count - i);
+}
+
+static void ScaleQ15SSE2(const int16_t* src, int16_t scale, int8_t shift, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    int kShift = 15 - shift;
+    {
+        __m128i vs = _mm_set1_epi16(scale);
+        __m128i vk = _mm_cvtsi32_si128(kShift);
+        for (; i + 8 <= count; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo = _mm_mullo_epi16(v, vs);
+            __m128i hi = _mm_mulhi_epi16(v, vs);
+            __m128i p0 = _mm_sra_epi32(_mm_unpacklo_epi16(lo, hi), vk);
+            __m128i p1 = _mm_sra_epi32(_mm_unpackhi_epi16(lo, hi), vk);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(p0, p1));
+        }
+    }
+    ScaleQ15Scalar(src + i, scale, shift, dst + i, count - i);
+}
+
+/* signed overflow when both operands differ in sign from the sum, clamp towards the sign of a */
+static void AddQ31SSE2(const int32_t* a, const int32_t* b, int32_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    __m128i max = _mm_set1_epi32(INT32_MAX);
+    for (; i + 4 <= count; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i sum = _mm_add_epi32(va, vb);
+        __m128i overflow = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(va, sum), _mm_xor_si128(vb, sum)), 31);
+        __m128i clamp = _mm_xor_si128(_mm_srai_epi32(va, 31), max);
+        sum = _mm_or_si128(_mm_and_si128(overflow, clamp), _mm_andnot_si128(overflow, sum));
+        _mm_storeu_si128((__m128i*)(dst + i), sum);
+    }
+    AddQ31Scalar(a + i, b + i, dst + i, count - i);
+}
+
+/*
+ * (mult * x) >> 16 split as high * x + ((low * x) >> 16) with the unsigned low
+ * half: mulhi treats low as signed, which is off by exactly x when its top
+ * bit is set.
+ */
+static __m128i GainSSE2(__m128i x, __m128i high, __m128i low, __m128i lowSign)
+{
+    __m128i lo = _mm_mullo_epi16(x, high);
+    __m128i hi = _mm_mulhi_epi16(x, high);
+    __m128i fraction = _mm_add_epi16(_mm_mulhi_epi16(x, low), _mm_and_si128(x, lowSign));
+    __m128i carry = _mm_srai_epi16(fraction, 15);
+    __m128i p0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), _mm_unpacklo_epi16(fraction, carry));
+    __m128i p1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), _mm_unpackhi_epi16(fraction, carry));
+    return _mm_packs_epi32(p0, p1);
+}
+
+static void GainQ15SSE2(const int16_t* src, int32_t mult, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    __m128i high = _mm_set1_epi16(mult >> 16);
+    __m128i low = _mm_set1_epi16(mult & 0xFFFF);
+    __m128i lowSign = _mm_set1_epi16(mult & 0x8000 ? -1 : 0);
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), GainSSE2(x, high, low, lowSign));
+    }
+    GainQ15Scalar(src + i, mult, dst + i, count - i);
+}
+
+static void GainAddQ15SSE2(const int16_t* src, int32_t mult, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    __m128i high = _mm_set1_epi16(mult >> 16);
+    __m128i low = _mm_set1_epi16(mult & 0xFFFF);
+    __m128i lowSign = _mm_set1_epi16(mult & 0x8000 ? -1 : 0);
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epi16(d, GainSSE2(x, high, low, lowSign)));
+    }
+    GainAddQ15Scalar(src + i, mult, dst + i, count - i);
+}
+
+static void InterleaveQ15SSE2(const int16_t* left, const int16_t* right, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i*)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i*)(right + i));
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+    }
+    InterleaveQ15Scalar(left + i, right + i, dst + i * 2, count - i);
+}
+
+__attribute__((target("avx2"))) static void AddQ15AVX2(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epi16(va, vb));
+    }
+    AddQ15SSE2(a + i, b + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void SubQ15AVX2(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_subs_epi16(va, vb));
+    }
+    SubQ15SSE2(a + i, b + i, dst + i, count - i);
+}
+
+/* unpack and pack work per 128 bit lane, so the lanes stay in order */
+__attribute__((target("avx2"))) static void MultQ15AVX2(const int16_t* a, const int16_t* b, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i lo = _mm256_mullo_epi16(va, vb);
+        __m256i hi = _mm256_mulhi_epi16(va, vb);
+        __m256i p0 = _mm256_srai_epi32(_mm256_unpacklo_epi16(lo, hi), 15);
+        __m256i p1 = _mm256_srai_epi32(_mm256_unpackhi_epi16(lo, hi), 15);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packs_epi32(p0, p1));
+    }
+    MultQ15SSE2(a + i, b + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void ScaleQ15AVX2(const int16_t* src, int16_t scale, int8_t shift, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    int kShift = 15 - shift;
+    {
+        __m256i vs = _mm256_set1_epi16(scale);
+        __m128i vk = _mm_cvtsi32_si128(kShift);
+        for (; i + 16 <= count; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+            __m256i lo = _mm256_mullo_epi16(v, vs);
+            __m256i hi = _mm256_mulhi_epi16(v, vs);
+            __m256i p0 = _mm256_sra_epi32(_mm256_unpacklo_epi16(lo, hi), vk);
+            __m256i p1 = _mm256_sra_epi32(_mm256_unpackhi_epi16(lo, hi), vk);
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packs_epi32(p0, p1));
+        }
+    }
+    ScaleQ15SSE2(src + i, scale, shift, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void AddQ31AVX2(const int32_t* a, const int32_t* b, int32_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    __m256i max = _mm256_set1_epi32(INT32_MAX);
+    for (; i + 8 <= count; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i sum = _mm256_add_epi32(va, vb);
+        __m256i overflow = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(va, sum), _mm256_xor_si256(vb, sum)), 31);
+        __m256i clamp = _mm256_xor_si256(_mm256_srai_epi32(va, 31), max);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(sum, clamp, overflow));
+    }
+    AddQ31SSE2(a + i, b + i, dst + i, count - i);
+}
+
+/* 64 bit products of the even lanes, odd lanes shifted down into place */
+__attribute__((target("avx2"))) static void ScaleQ31AVX2(const int32_t* src, int32_t scale, int8_t shift, int32_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    int8_t kShift = shift + 1;
+    if (kShift < 0) {
+        __m256i vs = _mm256_set1_epi32(scale);
+        __m128i vk = _mm_cvtsi32_si128(-kShift);
+        for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+            __m256i even = _mm256_srli_epi64(_mm256_mul_epi32(v, vs), 32);
+            __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(v, 32), vs);
+            __m256i high = _mm256_blend_epi32(even, odd, 0xAA);
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_sra_epi32(high, vk));
+        }
+    }
+    ScaleQ31Scalar(src + i, scale, shift, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static __m256i GainAVX2(__m256i x, __m256i high, __m256i low, __m256i lowSign)
+{
+    __m256i lo = _mm256_mullo_epi16(x, high);
+    __m256i hi = _mm256_mulhi_epi16(x, high);
+    __m256i fraction = _mm256_add_epi16(_mm256_mulhi_epi16(x, low), _mm256_and_si256(x, lowSign));
+    __m256i carry = _mm256_srai_epi16(fraction, 15);
+    __m256i p0 = _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), _mm256_unpacklo_epi16(fraction, carry));
+    __m256i p1 = _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), _mm256_unpackhi_epi16(fraction, carry));
+    return _mm256_packs_epi32(p0, p1);
+}
+
+__attribute__((target("avx2"))) static void GainQ15AVX2(const int16_t* src, int32_t mult, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    __m256i high = _mm256_set1_epi16(mult >> 16);
+    __m256i low = _mm256_set1_epi16(mult & 0xFFFF);
+    __m256i lowSign = _mm256_set1_epi16(mult & 0x8000 ? -1 : 0);
+    for (; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), GainAVX2(x, high, low, lowSign));
+    }
+    GainQ15SSE2(src + i, mult, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void GainAddQ15AVX2(const int16_t* src, int32_t mult, int16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+    __m256i high = _mm256_set1_epi16(mult >> 16);
+    __m256i low = _mm256_set1_epi16(mult & 0xFFFF);
+    __m256i lowSign = _mm256_set1_epi16(mult & 0x8000 ? -1 : 0);
+    for (; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epi16(d, GainAVX2(x, high, low, lowSign)));
+    }
+    GainAddQ15SSE2(src + i, mult, dst + i, count - i);
+}
+
+#endif
+
+const DSPKernels& ScalarDSPKernels()
+{
+    static const DSPKernels kernels = {"scalar", AddQ15Scalar, SubQ15Scalar, MultQ15Scalar, ScaleQ15Scalar, AddQ31Scalar, ScaleQ31Scalar,
+        GainQ15Scalar, GainAddQ15Scalar, InterleaveQ15Scalar};
+    return kernels;
+}
+
+const DSPKernels& HostDSPKernels()
+{
+#ifdef DSP_X86
+    static const DSPKernels sse2 = {"sse2", AddQ15SSE2, SubQ15SSE2, MultQ15SSE2, ScaleQ15SSE2, AddQ31SSE2, ScaleQ31Scalar,
+        GainQ15SSE2, GainAddQ15SSE2, InterleaveQ15SSE2};
+    static const DSPKernels avx2 = {"avx2", AddQ15AVX2, SubQ15AVX2, MultQ15AVX2, ScaleQ15AVX2, AddQ31AVX2, ScaleQ31AVX2,
+        GainQ15AVX2, GainAddQ15AVX2, InterleaveQ15SSE2};
+    static const DSPKernels& kernels = __builtin_cpu_supports("avx2") ? avx2 : sse2;
+    return kernels;
+#else
+    return ScalarDSPKernels();
+#endif
+}
+
+/* guest buffers which are not plain memory (or straddle a device) run the firmware code */
+template<class T> static T* Buffer(const HLECall& call, u32 addr, std::size_t count)
+{
+    return (T*)call.Pointer(addr, count * sizeof(T));
+}
+
+static HLERange Output(u32 addr, std::size_t size)
+{
+    return {addr, (u32)size};
+}
+
+void RegisterDSPFunctions(HLERegistry& hle)
+{
+    const auto& kernels = HostDSPKernels();
+
+    hle.Register("memcpy", {[](const HLECall& call) {
+        u32 dst = call.Arg(0), src = call.Arg(1), size = call.Arg(2);
+        void* to = Buffer<u8>(call, dst, size);
+        const void* from = Buffer<u8>(call, src, size);
+        if (size && (!to || !from)) {
+            return call.CallOriginal();
+        }
+        memmove(to, from, size);
+        return dst;
+    }, true, 0, [](const HLECall& call) { return std::vector<HLERange>{Output(call.Arg(0), call.Arg(2))}; }});
+
+    hle.Register("memset", {[](const HLECall& call) {
+        u32 dst = call.Arg(0), size = call.Arg(2);
+        void* to = Buffer<u8>(call, dst, size);
+        if (size && !to) {
+            return call.CallOriginal();
+        }
+        memset(to, call.Arg(1), size);
+        return dst;
+    }, true, 0, [](const HLECall& call) { return std::vector<HLERange>{Output(call.Arg(0), call.Arg(2))}; }});
+
+    /* arm_add_q15(pSrcA, pSrcB, pDst, blockSize) and friends */
+    auto binaryQ15 = [&hle](const char* symbol, void (*kernel)(const int16_t*, const int16_t*, int16_t*, std::size_t)) {
+        hle.Register(symbol, {[kernel](const HLECall& call) {
+            u32 count = call.Arg(3);
+            auto* a = Buffer<const int16_t>(call, call.Arg(0), count);
+            auto* b = Buffer<const int16_t>(call, call.Arg(1), count);
+            auto* dst = Buffer<int16_t>(call, call.Arg(2), count);
+            if (count && (!a || !b || !dst)) {
+                return call.CallOriginal();
+            }
+            kernel(a, b, dst, count);
+            return 0u;
+        }, false, 0, [](const HLECall& call) { return std::vector<HLERange>{Output(call.Arg(2), call.Arg(3) * sizeof(int16_t))}; }});
+    };
+    binaryQ15("arm_add_q15", kernels.addQ15);
+    binaryQ15("arm_sub_q15", kernels.subQ15);
+    binaryQ15("arm_mult_q15", kernels.multQ15);
+
+    hle.Register("arm_add_q31", {[kernel = kernels.addQ31](const HLECall& call) {
+        u32 count = call.Arg(3);
+        auto* a = Buffer<const int32_t>(call, call.Arg(0), count);
+        auto* b = Buffer<const int32_t>(call, call.Arg(1), count);
+        auto* dst = Buffer<int32_t>(call, call.Arg(2), count);
+        if (count && (!a || !b || !dst)) {
+            return call.CallOriginal();
+        }
+        kernel(a, b, dst, count);
+        return 0u;
+    }, false, 0, [](const HLECall& call) { return std::vector<HLERange>{Output(call.Arg(2), call.Arg(3) * sizeof(int32_t))}; }});
+
+    /* arm_scale_q15(pSrc, scaleFract, shift, pDst, blockSize): the block size is on the stack */
+    hle.Register("arm_scale_q15", {[kernel = kernels.scaleQ15](const HLECall& call) {
+        u32 count = call.Arg(4);
+        int8_t shift = call.Arg(2);
+        auto* src = Buffer<const int16_t>(call, call.Arg(0), count);
+        auto* dst = Buffer<int16_t>(call, call.Arg(3), count);
+        if ((count && (!src || !dst)) || shift < -16 || shift > 15) {
+            return call.CallOriginal(1);
+        }
+        kernel(src, call.Arg(1), shift, dst, count);
+        return 0u;
+    }, false, 1, [](const HLECall& call) { return std::vector<HLERange>{Output(call.Arg(3), call.Arg(4) * sizeof(int16_t))}; }});
+
+    hle.Register("arm_scale_q31", {[kernel = kernels.scaleQ31](const HLECall& call) {
+        u32 count = call.Arg(4);
+        int8_t shift = call.Arg(2);
+        auto* src = Buffer<const int32_t>(call, call.Arg(0), count);
+        auto* dst = Buffer<int32_t>(call, call.Arg(3), count);
+        if ((count && (!src || !dst)) || shift < -32 || shift > 30) {
+            return call.CallOriginal(1);
+        }
+        kernel(src, call.Arg(1), shift, dst, count);
+        return 0u;
+    }, false, 1, [](const HLECall& call) { return std::vector<HLERange>{Output(call.Arg(3), call.Arg(4) * sizeof(int32_t))}; }});
+
+    ext::LogInfo("DSP: %s kernels, %zu functions replaced", kernels.name, hle.Count());
+}
+
+} // namespace m8
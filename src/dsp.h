@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+#include <cstddef>
+
+namespace m8 {
+
+class HLERegistry;
+
+/*
+ * Host versions of the CMSIS-DSP basic math kernels the firmware uses, bit
+ * exact with the Cortex-M7 code. AVX2 or SSE2 is picked once at startup,
+ * other hosts use the scalar loops.
+ */
+struct DSPKernels {
+    const char* name;
+    void (*addQ15)(const std::int16_t* a, const std::int16_t* b, std::int16_t* dst, std::size_t count);
+    void (*subQ15)(const std::int16_t* a, const std::int16_t* b, std::int16_t* dst, std::size_t count);
+    void (*multQ15)(const std::int16_t* a, const std::int16_t* b, std::int16_t* dst, std::size_t count);
+    void (*scaleQ15)(const std::int16_t* src, std::int16_t scale, std::int8_t shift, std::int16_t* dst, std::size_t count);
+    void (*addQ31)(const std::int32_t* a, const std::int32_t* b, std::int32_t* dst, std::size_t count);
+    void (*scaleQ31)(const std::int32_t* src, std::int32_t scale, std::int8_t shift, std::int32_t* dst, std::size_t count);
+    /* Teensy Audio gain: (mult * x) >> 16 saturated (SMULWB + SSAT), the second one then adds into dst (QADD16) */
+    void (*gainQ15)(const std::int16_t* src, std::int32_t mult, std::int16_t* dst, std::size_t count);
+    void (*gainAddQ15)(const std::int16_t* src, std::int32_t mult, std::int16_t* dst, std::size_t count);
+    /* two mono blocks to L/R frames */
+    void (*interleaveQ15)(const std::int16_t* left, const std::int16_t* right, std::int16_t* dst, std::size_t count);
+};
+
+const DSPKernels& ScalarDSPKernels();
+const DSPKernels& HostDSPKernels();
+
+/* memcpy/memset and the arm_math kernels above, for the symbols firmware.yaml lists */
+void RegisterDSPFunctions(HLERegistry& hle);
+
+} // namespace m8
@@ -6,6 +6,9 @@
 
 namespace m8 {
 
+static thread_local u64 threadCycles = 0;
+static thread_local Dynarmic::A32::Jit* currentJit = nullptr;
+
 CoreCallbacks::CoreCallbacks()
 {
     pageTable = std::make_shared<std::array<u8*, Dynarmic::A32::UserConfig::NUM_PAGE_TABLE_ENTRIES>>();
@@ -13,8 +16,7 @@ CoreCallbacks::CoreCallbacks()
 
 void CoreCallbacks::BindDevice(Device* dev)
 {
-    devices.emplace(dev->BaseAddress(), dev);
-    devices.emplace(dev->EndAddress(), dev);
+    dispatcher.MapDevice(dev);
     dev->UpdatePageTable(*pageTable);
 }
 
@@ -30,41 +32,56 @@ void CoreCallbacks::unlock()
 
 void CoreCallbacks::PreCodeTranslationHook(bool is_thumb, u32 pc, Dynarmic::A32::IREmitter& ir)
 {
+    for (const auto& hook : globalTranslationHooks) {
+        hook(is_thumb, pc, ir);
+    }
     auto iter = translationHooks.find(pc);
     if (iter != translationHooks.end()) {
         iter->second(pc, ir);
     }
 }
 
-static Device* get_device(u32 addr, const std::map<u32, Device*>& devices)
+static Device* get_device(u32 addr, const MemoryDispatcher& dispatcher)
 {
-    auto iter = devices.lower_bound(addr);
-    if (iter != devices.end()) {
-        Device* dev = iter->second;
-        if (addr >= dev->BaseAddress() && addr <= dev->EndAddress()) {
-            return dev;
-        }
+    Device* dev = dispatcher.FindDevice(addr);
+    if (!dev) {
+        ext::LogDebug("get_device nullptr: addr = 0x%x", addr);
     }
-    ext::LogDebug("get_device nullptr: addr = 0x%x", addr);
-    return nullptr;
+    return dev;
 }
 
-void CoreCallbacks::MemoryRead(u32 addr, void* buffer, int length)
+int CoreCallbacks::MemoryRead(u32 addr, void* buffer, int length)
 {
-    Device* dev = get_device(addr, devices);
-    if (dev) {
-        u32 offset = addr - dev->BaseAddress();
-        dev->Read(offset, buffer, length);
+    auto* data = (u8*)buffer;
+    int done = 0;
+    while (done < length) {
+        Device* dev = get_device(addr + done, dispatcher);
+        if (!dev) {
+            break;
+        }
+        u32 offset = addr + done - dev->BaseAddress();
+        int chunk = std::min<u64>(length - done, (u64)dev->Size() - offset);
+        dev->Read(offset, data + done, chunk);
+        done += chunk;
     }
+    return done;
 }
 
-void CoreCallbacks::MemoryWrite(u32 addr, void* buffer, int length)
+int CoreCallbacks::MemoryWrite(u32 addr, void* buffer, int length)
 {
-    Device* dev = get_device(addr, devices);
-    if (dev) {
-        u32 offset = addr - dev->BaseAddress();
-        dev->Write(offset, buffer, length);
+    auto* data = (u8*)buffer;
+    int done = 0;
+    while (done < length) {
+        Device* dev = get_device(addr + done, dispatcher);
+        if (!dev) {
+            break;
+        }
+        u32 offset = addr + done - dev->BaseAddress();
+        int chunk = std::min<u64>(length - done, (u64)dev->Size() - offset);
+        dev->Write(offset, data + done, chunk);
+        done += chunk;
     }
+    return done;
 }
 
 u8 CoreCallbacks::MemoryRead8(u32 vaddr)
@@ -83,10 +100,10 @@ u16 CoreCallbacks::MemoryRead16(u32 vaddr)
 
 u32 CoreCallbacks::MemoryRead32(u32 vaddr)
 {
-    if (readHooks.find(vaddr) != readHooks.end()) {
-        return readHooks[vaddr](vaddr);
+    if (auto hook = dispatcher.FindReadHook(vaddr)) {
+        return (*hook)(vaddr);
     } else {
-        Device* dev = get_device(vaddr, devices);
+        Device* dev = get_device(vaddr, dispatcher);
         if (!dev) {
             return 0;
         } else {
@@ -115,10 +132,10 @@ void CoreCallbacks::MemoryWrite16(u32 vaddr, u16 value)
 
 void CoreCallbacks::MemoryWrite32(u32 vaddr, u32 value)
 {
-    if (writeHooks.find(vaddr) != writeHooks.end()) {
-        writeHooks[vaddr](vaddr, value);
+    if (auto hook = dispatcher.FindWriteHook(vaddr)) {
+        (*hook)(vaddr, value);
     } else {
-        Device* dev = get_device(vaddr, devices);
+        Device* dev = get_device(vaddr, dispatcher);
         if (dev) {
             u32 offset = vaddr - dev->BaseAddress();
             dev->Write32(offset, value);
@@ -139,7 +156,7 @@ bool CoreCallbacks::MemoryWriteExclusive32(u32 vaddr, u32 value, u32 expected)
 
 void* CoreCallbacks::MemoryMap(u32 addr)
 {
-    Device* dev = get_device(addr, devices);
+    Device* dev = get_device(addr, dispatcher);
     if (!dev) {
         return nullptr;
     } else {
@@ -164,11 +181,28 @@ void CoreCallbacks::ExceptionRaised(u32 pc, Dynarmic::A32::Exception exception)
 
 void CoreCallbacks::AddTicks(u64 ticks)
 {
+    cycles.fetch_add(ticks, std::memory_order_relaxed);
+    threadCycles += ticks;
 }
 
 u64 CoreCallbacks::GetTicksRemaining()
 {
-    return 1;
+    return ticksPerRun;
+}
+
+u64 CoreCallbacks::ThreadCycles()
+{
+    return threadCycles;
+}
+
+void CoreCallbacks::SetCurrentJit(Dynarmic::A32::Jit* jit)
+{
+    currentJit = jit;
+}
+
+Dynarmic::A32::Jit* CoreCallbacks::CurrentJit()
+{
+    return currentJit;
 }
 
 } // namespace m8
@@ -2,8 +2,11 @@
 
 #include <map>
 #include <mutex>
+#include <atomic>
+#include <vector>
 #include <functional>
 #include "io.h"
+#include "dispatch.h"
 
 namespace m8 {
 
@@ -14,8 +17,9 @@ public:
 
     void lock();
     void unlock();
-    void MemoryRead(u32 addr, void* buffer, int length);
-    void MemoryWrite(u32 addr, void* buffer, int length);
+    /* split at device ends, return the bytes up to the first unmapped address */
+    int MemoryRead(u32 addr, void* buffer, int length);
+    int MemoryWrite(u32 addr, void* buffer, int length);
 
     void PreCodeTranslationHook(bool is_thumb, u32 pc, Dynarmic::A32::IREmitter& ir) override;
 
@@ -35,9 +39,10 @@ public:
 
     std::array<u8*, Dynarmic::A32::UserConfig::NUM_PAGE_TABLE_ENTRIES>& PageTable() { return *pageTable; }
 
-    void AddReadHook(u32 addr, std::function<u32(u32)> hook) { readHooks[addr] = hook; }
-    void AddWriteHook(u32 addr, std::function<void(u32, u32)> hook) { writeHooks[addr] = hook; }
+    void AddReadHook(u32 addr, ReadHook hook) { dispatcher.AddReadHook(addr, hook); }
+    void AddWriteHook(u32 addr, WriteHook hook) { dispatcher.AddWriteHook(addr, hook); }
     void AddTranslationHook(u32 addr, std::function<void(u32, Dynarmic::A32::IREmitter&)> hook) { translationHooks[addr] = hook; }
+    void AddGlobalTranslationHook(std::function<void(bool, u32, Dynarmic::A32::IREmitter&)> hook) { globalTranslationHooks.push_back(hook); }
 
     void InterpreterFallback(u32 pc, size_t num_instructions) override;
     void CallSVC(u32 swi) override;
@@ -45,13 +50,22 @@ public:
     void AddTicks(u64 ticks) override;
     u64 GetTicksRemaining() override;
 
+    void SetTicksPerRun(u64 ticks) { ticksPerRun = ticks; }
+    u64 TicksPerRun() const { return ticksPerRun; }
+    u64 Cycles() const { return cycles.load(std::memory_order_relaxed); }
+    static u64 ThreadCycles();
+
+    static void SetCurrentJit(Dynarmic::A32::Jit* jit);
+    static Dynarmic::A32::Jit* CurrentJit();
+
 protected:
     std::recursive_mutex mutex;
+    std::atomic<u64> cycles{0};
+    u64 ticksPerRun = 1;
     std::shared_ptr<std::array<u8*, Dynarmic::A32::UserConfig::NUM_PAGE_TABLE_ENTRIES>> pageTable;
-    std::map<u32, Device*> devices;
-    std::map<u32, std::function<u32(u32)>> readHooks;
-    std::map<u32, std::function<void(u32, u32)>> writeHooks;
+    MemoryDispatcher dispatcher;
     std::map<u32, std::function<void(u32, Dynarmic::A32::IREmitter&)>> translationHooks;
+    std::vector<std::function<void(bool, u32, Dynarmic::A32::IREmitter&)>> globalTranslationHooks;
 };
 
 } // namespace m8
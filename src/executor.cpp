@@ -0,0 +1,220 @@
+#include "executor.h"
+#include <set>
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+#include <ext/log.h>
+
+#define COST_SMOOTHING   0.125 // weight of a new sample in the moving average
+#define PRIORITY_PERIOD  64    // cycles between re-ranking
+#define REPORT_PERIOD    1024  // cycles between makespan reports
+
+namespace m8 {
+
+static u64 NowNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+GraphExecutor::GraphExecutor(int workers, Task task) : task(task), workers(workers)
+{
+}
+
+GraphExecutor::~GraphExecutor()
+{
+    {
+        std::lock_guard lock(mutex);
+        running = false;
+        generation++;
+    }
+    cycleStart.notify_all();
+    for (auto& worker : pool) {
+        worker.join();
+    }
+}
+
+void GraphExecutor::Compile(int count, const std::vector<std::tuple<int, int>>& edges, const std::vector<double>& costs)
+{
+    std::vector<std::set<int>> dependents(count);
+    for (auto [from, to] : edges) {
+        if (from != to) {
+            dependents[from].insert(to);
+        }
+    }
+    nodes.assign(count, {});
+    for (int i = 0; i < count && i < costs.size(); i++) {
+        nodes[i].cost = costs[i];
+    }
+    for (int i = 0; i < count; i++) {
+        nodes[i].dependents.assign(dependents[i].begin(), dependents[i].end());
+        for (int dependent : dependents[i]) {
+            nodes[dependent].dependencies++;
+        }
+    }
+    pending = std::make_unique<std::atomic<int>[]>(count);
+    readyWords = (count + 63) / 64;
+    ready = std::make_unique<std::atomic<u64>[]>(readyWords);
+
+    /* Kahn's algorithm, ranks are computed bottom-up along this order */
+    topological.clear();
+    std::vector<int> indegree(count);
+    for (int i = 0; i < count; i++) {
+        indegree[i] = nodes[i].dependencies;
+        if (!indegree[i]) {
+            topological.push_back(i);
+        }
+    }
+    for (int i = 0; i < topological.size(); i++) {
+        for (int dependent : nodes[topological[i]].dependents) {
+            if (--indegree[dependent] == 0) {
+                topological.push_back(dependent);
+            }
+        }
+    }
+    if (topological.size() != count) {
+        ext::LogError("GraphExecutor: dependency cycle, %d of %d nodes schedulable", (int)topological.size(), count);
+    }
+    slotNodes.resize(count);
+    UpdatePriorities();
+}
+
+void GraphExecutor::UpdatePriorities()
+{
+    criticalPath = 0;
+    for (auto iter = topological.rbegin(); iter != topological.rend(); iter++) {
+        auto& node = nodes[*iter];
+        double below = 0;
+        for (int dependent : node.dependents) {
+            below = std::max(below, nodes[dependent].rank);
+        }
+        node.rank = node.cost + below;
+        criticalPath = std::max(criticalPath, node.rank);
+    }
+    /* lower slots are claimed first, ties keep the compile order */
+    std::iota(slotNodes.begin(), slotNodes.end(), 0);
+    std::stable_sort(slotNodes.begin(), slotNodes.end(), [this](int a, int b) { return nodes[a].rank > nodes[b].rank; });
+    for (int slot = 0; slot < slotNodes.size(); slot++) {
+        nodes[slotNodes[slot]].slot = slot;
+    }
+}
+
+void GraphExecutor::Report(u64 duration)
+{
+    makespan = duration;
+    makespanSum += duration;
+    makespanMax = std::max(makespanMax, duration);
+    if (++cycles % REPORT_PERIOD == 0) {
+        double work = 0;
+        for (const auto& node : nodes) {
+            work += node.cost;
+        }
+        ext::LogDebug("GraphExecutor: makespan avg = %.1f us, max = %.1f us, critical path = %.1f us, work = %.1f us on %d workers",
+            makespanSum / (double)REPORT_PERIOD / 1000, makespanMax / 1000.0, criticalPath / 1000, work / 1000, workers);
+        makespanSum = 0;
+        makespanMax = 0;
+    }
+}
+
+void GraphExecutor::Run()
+{
+    if (nodes.empty()) {
+        return;
+    }
+    while (pool.size() < workers) {
+        pool.emplace_back([this]() { WorkerLoop(); });
+    }
+    if (cycles % PRIORITY_PERIOD == 0) {
+        UpdatePriorities();
+    }
+    u64 start = NowNanoseconds();
+    for (int i = 0; i < nodes.size(); i++) {
+        pending[i].store(nodes[i].dependencies, std::memory_order_relaxed);
+    }
+    remaining.store(nodes.size(), std::memory_order_relaxed);
+    for (int i = 0; i < readyWords; i++) {
+        ready[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < nodes.size(); i++) {
+        if (!nodes[i].dependencies) {
+            SetReady(i);
+        }
+    }
+
+    std::unique_lock lock(mutex);
+    generation++;
+    cycleStart.notify_all();
+    /* waiting for the workers to leave the cycle too keeps Compile() from racing a straggler */
+    cycleDone.wait(lock, [this]() { return remaining.load(std::memory_order_acquire) == 0 && busy == 0; });
+    lock.unlock();
+    Report(NowNanoseconds() - start);
+}
+
+void GraphExecutor::WorkerLoop()
+{
+    u64 seen = 0;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            cycleStart.wait(lock, [this, &seen]() { return generation != seen; });
+            seen = generation;
+            if (!running) {
+                return;
+            }
+            busy++;
+        }
+        /* within a cycle workers spin, nodes are short and a sleep would cost more than the wait */
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            int node = ClaimReady();
+            if (node < 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            u64 start = NowNanoseconds();
+            task(node);
+            auto& cost = nodes[node].cost;
+            cost += (NowNanoseconds() - start - cost) * COST_SMOOTHING;
+            Finish(node);
+        }
+        std::lock_guard lock(mutex);
+        if (--busy == 0) {
+            cycleDone.notify_all();
+        }
+    }
+}
+
+int GraphExecutor::ClaimReady()
+{
+    for (int i = 0; i < readyWords; i++) {
+        u64 bits = ready[i].load(std::memory_order_acquire);
+        while (bits) {
+            u64 bit = bits & -bits;
+            u64 old = ready[i].fetch_and(~bit, std::memory_order_acq_rel);
+            if (old & bit) {
+                return slotNodes[i * 64 + __builtin_ctzll(bit)];
+            }
+            bits = old & ~bit;
+        }
+    }
+    return -1;
+}
+
+void GraphExecutor::SetReady(int node)
+{
+    int slot = nodes[node].slot;
+    ready[slot / 64].fetch_or(1ULL << (slot % 64), std::memory_order_release);
+}
+
+void GraphExecutor::Finish(int node)
+{
+    for (int dependent : nodes[node].dependents) {
+        if (pending[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            SetReady(dependent);
+        }
+    }
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard lock(mutex);
+        cycleDone.notify_all();
+    }
+}
+
+} // namespace m8
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace m8 {
+
+/*
+ * Runs a fixed DAG once per cycle on a pool of workers. The graph is compiled
+ * into dependents lists and in-degrees up front, a cycle only resets atomic
+ * counters and the workers claim ready nodes from a lock-free bitmap.
+ *
+ * Node durations are tracked as moving averages and ready nodes are claimed
+ * by upward rank (own cost plus the longest path below it, as in HEFT), so
+ * the chain that bounds the makespan starts first.
+ */
+class GraphExecutor {
+public:
+    using Task = std::function<void(int)>;
+
+    GraphExecutor(int workers, Task task);
+    ~GraphExecutor();
+    GraphExecutor(const GraphExecutor&) = delete;
+    GraphExecutor& operator=(const GraphExecutor&) = delete;
+
+    /* edge (from, to): node to runs after node from has finished */
+    void Compile(int nodes, const std::vector<std::tuple<int, int>>& edges, const std::vector<double>& costs = {});
+    void Run();
+
+    int Nodes() const { return nodes.size(); }
+    int Workers() const { return workers; }
+
+    /* average duration of a node in ns, passed back to Compile to keep it across edits */
+    double Cost(int node) const { return nodes[node].cost; }
+    u64 Makespan() const { return makespan; }
+    double CriticalPath() const { return criticalPath; }
+
+private:
+    struct Node {
+        int dependencies = 0;
+        std::vector<int> dependents;
+        double cost = 0;
+        double rank = 0;
+        int slot = 0;
+    };
+
+    void WorkerLoop();
+    int ClaimReady();
+    void SetReady(int node);
+    void Finish(int node);
+    void UpdatePriorities();
+    void Report(u64 duration);
+
+    Task task;
+    std::vector<Node> nodes;
+    std::vector<int> topological;
+    std::vector<int> slotNodes;
+    std::unique_ptr<std::atomic<int>[]> pending;
+    std::unique_ptr<std::atomic<u64>[]> ready;
+    int readyWords = 0;
+    std::atomic<int> remaining{0};
+    u64 cycles = 0;
+    u64 makespan = 0;
+    double criticalPath = 0;
+    u64 makespanSum = 0;
+    u64 makespanMax = 0;
+
+    bool running = true;
+    u64 generation = 0;
+    int busy = 0;
+    std::mutex mutex;
+    std::condition_variable cycleStart;
+    std::condition_variable cycleDone;
+    /* started by the first Run(), a process can fork before that */
+    int workers;
+    std::vector<std::thread> pool;
+};
+
+} // namespace m8
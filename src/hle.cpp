@@ -0,0 +1,140 @@
+#include "hle.h"
+#include "m8emu.h"
+#include <cstring>
+#include <ext/log.h>
+
+#define HLE_VERIFY_ALL "all"
+
+namespace m8 {
+
+u32 HLECall::Arg(int index) const
+{
+    if (index < regs.size()) {
+        return regs[index];
+    }
+    return emu.Callbacks().MemoryRead32(sp + (index - regs.size()) * sizeof(u32));
+}
+
+void* HLECall::Pointer(u32 addr, u32 size) const
+{
+    auto* begin = (u8*)emu.Callbacks().MemoryMap(addr);
+    if (!begin || size <= 1) {
+        return begin;
+    }
+    auto* last = (u8*)emu.Callbacks().MemoryMap(addr + size - 1);
+    return last == begin + size - 1 ? begin : nullptr;
+}
+
+u32 HLECall::CallOriginal(int stackArgs) const
+{
+    std::vector<u32> stack;
+    for (int i = 0; i < stackArgs; i++) {
+        stack.push_back(Arg(regs.size() + i));
+    }
+    return emu.CallOriginal(addr, regs, stack);
+}
+
+bool HLERegistry::Register(const std::string& symbol, HLEFunction function)
+{
+    u32 addr = emu.Config().GetSymbolAddress(symbol);
+    if (!addr) {
+        return false;
+    }
+    auto& entry = functions[symbol];
+    entry = std::make_unique<Entry>();
+    entry->symbol = symbol;
+    entry->addr = addr;
+    entry->function = std::move(function);
+    auto iter = verifySymbols.find(symbol);
+    entry->verify = iter != verifySymbols.end() ? iter->second : verifyAll;
+    emu.ReplaceFunction(addr, [this, ptr = entry.get()](u32 r0, u32 r1, u32 r2, u32 r3) {
+        return Call(*ptr, HLECall{emu, ptr->addr, {r0, r1, r2, r3}, emu.StackPointer()});
+    });
+    ext::LogDebug("HLE: %s at 0x%x replaced%s", symbol.c_str(), addr, entry->verify ? ", verifying" : "");
+    return true;
+}
+
+/* may come before or after Register(), "all" covers every symbol without an explicit setting */
+void HLERegistry::SetVerify(const std::string& symbol, bool enabled)
+{
+    if (symbol == HLE_VERIFY_ALL) {
+        verifyAll = enabled;
+        for (auto& [name, entry] : functions) {
+            if (!verifySymbols.count(name)) {
+                entry->verify = enabled;
+            }
+        }
+        return;
+    }
+    verifySymbols[symbol] = enabled;
+    auto iter = functions.find(symbol);
+    if (iter != functions.end()) {
+        iter->second->verify = enabled;
+    }
+}
+
+u32 HLERegistry::Call(Entry& entry, const HLECall& call)
+{
+    entry.calls.fetch_add(1, std::memory_order_relaxed);
+    if (entry.verify.load(std::memory_order_relaxed)) {
+        return Verify(entry, call);
+    }
+    return entry.function.call(call);
+}
+
+/*
+ * Host first, its outputs are saved and the inputs put back, then the guest
+ * code runs on the same state. Whatever the guest produced stays, so verify
+ * mode never changes what the firmware sees.
+ */
+u32 HLERegistry::Verify(Entry& entry, const HLECall& call)
+{
+    const auto& function = entry.function;
+    auto outputs = function.outputs ? function.outputs(call) : std::vector<HLERange>{};
+    std::vector<std::vector<u8>> inputs, results;
+    for (const auto& range : outputs) {
+        auto* ptr = (u8*)call.Pointer(range.addr, range.size);
+        if (!ptr) {
+            return call.CallOriginal(function.stackArgs);
+        }
+        inputs.emplace_back(ptr, ptr + range.size);
+    }
+    u32 hostResult = function.call(call);
+    for (int i = 0; i < outputs.size(); i++) {
+        auto* ptr = (u8*)call.Pointer(outputs[i].addr);
+        results.emplace_back(ptr, ptr + outputs[i].size);
+        memcpy(ptr, inputs[i].data(), outputs[i].size);
+    }
+    u32 guestResult = call.CallOriginal(function.stackArgs);
+
+    bool match = !function.returnsValue || hostResult == guestResult;
+    if (!match) {
+        ext::LogError("HLE: %s(0x%x, 0x%x, 0x%x, 0x%x) returned 0x%x, firmware 0x%x", entry.symbol.c_str(),
+            call.regs[0], call.regs[1], call.regs[2], call.regs[3], hostResult, guestResult);
+    }
+    for (int i = 0; i < outputs.size(); i++) {
+        auto* ptr = (u8*)call.Pointer(outputs[i].addr);
+        for (u32 offset = 0; offset < outputs[i].size; offset++) {
+            if (ptr[offset] != results[i][offset]) {
+                ext::LogError("HLE: %s wrote 0x%02x at 0x%x, firmware 0x%02x", entry.symbol.c_str(), results[i][offset], outputs[i].addr + offset, ptr[offset]);
+                match = false;
+                break;
+            }
+        }
+    }
+    entry.verified.fetch_add(1, std::memory_order_relaxed);
+    if (!match) {
+        entry.mismatches.fetch_add(1, std::memory_order_relaxed);
+    }
+    return guestResult;
+}
+
+void HLERegistry::Report() const
+{
+    for (const auto& [symbol, entry] : functions) {
+        ext::LogInfo("HLE: %s calls = %llu, verified = %llu, mismatches = %llu", symbol.c_str(), (unsigned long long)entry->calls.load(),
+            (unsigned long long)entry->verified.load(), (unsigned long long)entry->mismatches.load());
+    }
+}
+
+} // namespace m8
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.h"
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace m8 {
+
+class M8Emulator;
+
+/* arguments of a replaced call: R0-R3, then words on the caller's stack (AAPCS) */
+struct HLECall {
+    M8Emulator& emu;
+    u32 addr;
+    std::array<u32, 4> regs;
+    u32 sp;
+
+    u32 Arg(int index) const;
+    /* host pointer for a guest range, null unless it is contiguous memory */
+    void* Pointer(u32 addr, u32 size = 1) const;
+    /* the firmware's own code with the same arguments, for cases the host side doesn't cover */
+    u32 CallOriginal(int stackArgs = 0) const;
+};
+
+struct HLERange {
+    u32 addr;
+    u32 size;
+};
+
+struct HLEFunction {
+    std::function<u32(const HLECall&)> call;
+    bool returnsValue = true;
+    int stackArgs = 0;
+    /* guest memory the function writes, compared in verify mode */
+    std::function<std::vector<HLERange>(const HLECall&)> outputs;
+};
+
+/*
+ * Host implementations of firmware functions keyed by firmware.yaml symbol.
+ * A registered function replaces the guest one entirely. In verify mode both
+ * run on the same inputs, the guest result is kept and mismatches are logged.
+ */
+class HLERegistry {
+public:
+    explicit HLERegistry(M8Emulator& emu) : emu(emu) {}
+
+    bool Register(const std::string& symbol, HLEFunction function);
+    void SetVerify(const std::string& symbol, bool enabled);
+    bool Registered(const std::string& symbol) const { return functions.count(symbol) > 0; }
+    std::size_t Count() const { return functions.size(); }
+    void Report() const;
+
+private:
+    struct Entry {
+        std::string symbol;
+        u32 addr;
+        HLEFunction function;
+        std::atomic<bool> verify{false};
+        std::atomic<u64> calls{0};
+        std::atomic<u64> verified{0};
+        std::atomic<u64> mismatches{0};
+    };
+
+    u32 Call(Entry& entry, const HLECall& call);
+    u32 Verify(Entry& entry, const HLECall& call);
+
+    M8Emulator& emu;
+    std::map<std::string, std::unique_ptr<Entry>> functions;
+    std::map<std::string, bool> verifySymbols;
+    bool verifyAll = false;
+};
+
+} // namespace m8
@@ -0,0 +1,146 @@
+#include "idle.h"
+#include <ext/disassembler.h>
+#include <ext/ir.h>
+#include <ext/log.h>
+
+#define THUMB_WFI 0xBF30
+#define THUMB_WFE 0xBF20
+
+#define POLLING_LOOP_WINDOW  48 // bytes, a dozen thumb instructions
+#define POLLING_LOOP_HITS    64 // iterations within one run slice before the core counts as idle
+
+namespace m8 {
+
+/* 32-bit b<cond>.w (T3) and b.w (T4), returns false for anything else */
+static bool Thumb32BranchOffset(u16 first, u16 second, std::int32_t& offset)
+{
+    if ((first & 0xF800) != 0xF000 || (second & 0xC000) != 0x8000) {
+        return false;
+    }
+    u32 s = (first >> 10) & 1;
+    u32 j1 = (second >> 13) & 1;
+    u32 j2 = (second >> 11) & 1;
+    if (second & 0x1000) {
+        u32 i1 = ~(j1 ^ s) & 1;
+        u32 i2 = ~(j2 ^ s) & 1;
+        u32 imm = (s << 24) | (i1 << 23) | (i2 << 22) | ((first & 0x3FF) << 12) | ((second & 0x7FF) << 1);
+        offset = (std::int32_t)(imm << 7) >> 7;
+    } else {
+        /* cond 111x encodes other instructions */
+        if ((first & 0x0380) == 0x0380) {
+            return false;
+        }
+        u32 imm = (s << 20) | (j2 << 19) | (j1 << 18) | ((first & 0x3F) << 12) | ((second & 0x7FF) << 1);
+        offset = (std::int32_t)(imm << 11) >> 11;
+    }
+    return true;
+}
+
+/* cheap pre-filter before disassembling: some b/b<cond> in the window, 16 or 32-bit, branches back to pc */
+static bool HasBranchBack(const u16* code, u32 pc, int count)
+{
+    for (int i = 0; i < count; i++) {
+        u16 insn = code[i];
+        u32 addr = pc + i * 2;
+        std::int32_t offset;
+        if ((insn & 0xF000) == 0xD000 && (insn & 0x0E00) != 0x0E00) {
+            offset = (std::int8_t)(insn & 0xFF) * 2;
+        } else if ((insn & 0xF800) == 0xE000) {
+            offset = ((std::int32_t)((u32)(insn & 0x7FF) << 21) >> 21) * 2;
+        } else if (i + 1 >= count || !Thumb32BranchOffset(insn, code[i + 1], offset)) {
+            continue;
+        }
+        if (addr + 4 + offset == pc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+IdleDetector::IdleDetector(CoreCallbacks& callbacks) : callbacks(callbacks)
+{
+}
+
+void IdleDetector::Translate(bool is_thumb, u32 pc, Dynarmic::A32::IREmitter& ir)
+{
+    if (!enabled || !is_thumb) {
+        return;
+    }
+    auto code = (const u16*)callbacks.MemoryMap(pc);
+    if (!code) {
+        return;
+    }
+    if (*code == THUMB_WFI || *code == THUMB_WFE) {
+        ext::CallHostFunction(ir, WaitForInterruptWrapper, (u64)this);
+    } else if (IsPollingLoop(pc)) {
+        ext::CallHostFunction(ir, PollingLoopWrapper, (u64)this, pc);
+    }
+}
+
+bool IdleDetector::IsPollingLoop(u32 pc)
+{
+    std::lock_guard lock(cacheMutex);
+    auto iter = loopCache.find(pc);
+    if (iter != loopCache.end()) {
+        return iter->second;
+    }
+    bool loop = false;
+    /* the whole window has to be backed by the same mapping */
+    auto code = (const u8*)callbacks.MemoryMap(pc);
+    auto end = (const u8*)callbacks.MemoryMap(pc + POLLING_LOOP_WINDOW - 1);
+    if (code && end == code + POLLING_LOOP_WINDOW - 1 && HasBranchBack((const u16*)code, pc, POLLING_LOOP_WINDOW / 2)) {
+        loop = ext::IsPollingLoop(code, pc, POLLING_LOOP_WINDOW);
+        if (loop) {
+            ext::LogDebug("IdleDetector: polling loop at 0x%x", pc);
+        }
+    }
+    loopCache[pc] = loop;
+    return loop;
+}
+
+void IdleDetector::WaitForInterruptWrapper(u64 detector)
+{
+    auto self = (IdleDetector*)detector;
+    if (CoreCallbacks::CurrentJit() == self->mainJit) {
+        self->RequestIdle();
+    }
+}
+
+void IdleDetector::PollingLoopWrapper(u64 detector, u64 pc)
+{
+    auto self = (IdleDetector*)detector;
+    if (CoreCallbacks::CurrentJit() == self->mainJit) {
+        self->OnPollingLoop(pc);
+    }
+}
+
+void IdleDetector::OnPollingLoop(u32 pc)
+{
+    if (pc != loopPc) {
+        loopPc = pc;
+        loopHits = 0;
+    }
+    if (++loopHits >= POLLING_LOOP_HITS) {
+        RequestIdle();
+    }
+}
+
+void IdleDetector::RequestIdle()
+{
+    idle = true;
+    mainJit->HaltExecution();
+}
+
+bool IdleDetector::EndRun()
+{
+    bool wasIdle = idle;
+    idle = false;
+    loopPc = 0;
+    loopHits = 0;
+    if (wasIdle) {
+        idleCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return wasIdle;
+}
+
+} // namespace m8
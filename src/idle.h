@@ -0,0 +1,46 @@
+#pragma once
+
+#include "emu.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace m8 {
+
+/*
+ * Spots WFI/WFE and tight polling loops while code is translated and flags the
+ * main core as idle once it spins in them, so Run() can sleep until the next
+ * interrupt instead of burning a host core.
+ */
+class IdleDetector {
+public:
+    explicit IdleDetector(CoreCallbacks& callbacks);
+
+    void SetMainJit(Dynarmic::A32::Jit* jit) { mainJit = jit; }
+    void SetEnabled(bool enabled) { this->enabled = enabled; }
+    void Translate(bool is_thumb, u32 pc, Dynarmic::A32::IREmitter& ir);
+
+    /* true if the last run slice ended because the core went idle, resets the loop counter */
+    bool EndRun();
+    u64 IdleCount() const { return idleCount.load(std::memory_order_relaxed); }
+
+private:
+    static void WaitForInterruptWrapper(u64 detector);
+    static void PollingLoopWrapper(u64 detector, u64 pc);
+
+    bool IsPollingLoop(u32 pc);
+    void OnPollingLoop(u32 pc);
+    void RequestIdle();
+
+    CoreCallbacks& callbacks;
+    Dynarmic::A32::Jit* mainJit = nullptr;
+    bool enabled = true;
+    bool idle = false;
+    u32 loopPc = 0;
+    u32 loopHits = 0;
+    std::atomic<u64> idleCount{0};
+    std::mutex cacheMutex;
+    std::unordered_map<u32, bool> loopCache;
+};
+
+} // namespace m8
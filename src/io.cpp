@@ -3,41 +3,54 @@
 
 namespace m8 {
 
-MemoryDevice::MemoryDevice(u32 baseAddr, u32 size) : Device(baseAddr, size)
+MemoryDevice::MemoryDevice(u32 baseAddr, u32 size, u8* backing, bool readOnly) : Device(baseAddr, size), memory(backing), readOnly(readOnly)
 {
-    memory.resize(size);
+    if (!memory) {
+        storage.resize(size);
+        memory = storage.data();
+    }
 }
 
 void MemoryDevice::Read(u32 offset, void* buffer, u32 length)
 {
-    memcpy(buffer, memory.data() + offset, length);
+    memcpy(buffer, memory + offset, length);
 }
 
 void MemoryDevice::Write(u32 offset, void* buffer, u32 length)
 {
-    memcpy(memory.data() + offset, buffer, length);
+    if (readOnly) {
+        return;
+    }
+    memcpy(memory + offset, buffer, length);
 }
 
 u32 MemoryDevice::Read32(u32 offset)
 {
-    return *(u32*)(memory.data() + offset);
+    return *(u32*)(memory + offset);
 }
 
 void MemoryDevice::Write32(u32 offset, u32 value)
 {
-    *(u32*)(memory.data() + offset) = value;
+    if (readOnly) {
+        return;
+    }
+    *(u32*)(memory + offset) = value;
 }
 
 void* MemoryDevice::Map(u32 offset)
 {
-    return memory.data() + offset;
+    return memory + offset;
 }
 
 bool MemoryDevice::UpdatePageTable(std::array<u8*, Dynarmic::A32::UserConfig::NUM_PAGE_TABLE_ENTRIES>& table)
 {
+    /* page table entries are writable, read-only memory goes through the callbacks (reads still hit fastmem) */
+    if (readOnly) {
+        return false;
+    }
     for (u32 offset = 0; offset < size; offset += 1 << Dynarmic::A32::UserConfig::PAGE_BITS) {
         u32 addr = baseAddress + offset;
-        table[addr >> Dynarmic::A32::UserConfig::PAGE_BITS] = memory.data() + offset;
+        table[addr >> Dynarmic::A32::UserConfig::PAGE_BITS] = memory + offset;
     }
     return true;
 }
@@ -40,7 +40,7 @@ protected:
 
 class MemoryDevice : public Device {
 public:
-    MemoryDevice(u32 baseAddr, u32 size);
+    MemoryDevice(u32 baseAddr, u32 size, u8* backing = nullptr, bool readOnly = false);
 
     void Read(u32 offset, void* buffer, u32 length) override;
     void Write(u32 offset, void* buffer, u32 length) override;
@@ -53,7 +53,9 @@ public:
     bool UpdatePageTable(std::array<u8*, Dynarmic::A32::UserConfig::NUM_PAGE_TABLE_ENTRIES>& table) override;
 
 protected:
-    std::vector<u8> memory;
+    std::vector<u8> storage;
+    u8* memory;
+    bool readOnly;
 };
 
 struct Field {
@@ -0,0 +1,373 @@
+#include "loader.h"
+#include "md5.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <ext/log.h>
+
+#define CACHE_MAGIC   "M8IMAGE\0"
+#define CACHE_VERSION 1
+#define CACHE_SUFFIX  ".bin"
+
+#define PARSE_CHUNK_MIN   (256 * 1024) // bytes of HEX text per thread
+#define PARSE_THREADS_MAX 8
+
+#define IHEX_DATA                       0x00
+#define IHEX_END_OF_FILE                0x01
+#define IHEX_EXTENDED_SEGMENT_ADDRESS   0x02
+#define IHEX_EXTENDED_LINEAR_ADDRESS    0x04
+
+namespace m8 {
+
+struct CacheHeader {
+    char magic[8];
+    u32 version;
+    u32 segmentCount;
+    u64 size;
+    u64 mtime;
+    char md5sum[32];
+};
+
+struct CacheSegment {
+    u32 addr;
+    u32 size;
+};
+
+static int HexNibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static bool HexByte(const char* text, u8& value)
+{
+    int high = HexNibble(text[0]);
+    int low = HexNibble(text[1]);
+    value = (high << 4) | low;
+    return high >= 0 && low >= 0;
+}
+
+static std::string CacheMD5(const CacheHeader& header)
+{
+    return std::string(header.md5sum, strnlen(header.md5sum, sizeof(header.md5sum)));
+}
+
+FirmwareImage::~FirmwareImage()
+{
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+bool FirmwareImage::Load(const std::string& path, const std::string& md5sum)
+{
+    auto now = std::chrono::steady_clock::now();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        ext::LogError("Loader: failed to open %s: %s", path.c_str(), strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    u64 size = st.st_size;
+    u64 mtime = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    auto cachePath = path + CACHE_SUFFIX;
+    if (LoadCache(cachePath, size, mtime, md5sum)) {
+        close(fd);
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - now).count();
+        ext::LogInfo("Loader: %s loaded from %s in %.1f ms", path.c_str(), cachePath.c_str(), duration);
+        return true;
+    }
+
+    void* text = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (text == MAP_FAILED) {
+        ext::LogError("Loader: failed to map %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!md5sum.empty()) {
+        auto digest = MD5::HexDigest(text, size);
+        if (digest != md5sum) {
+            ext::LogError("Loader: %s md5sum %s does not match firmware.yaml (%s)", path.c_str(), digest.c_str(), md5sum.c_str());
+            munmap(text, size);
+            return false;
+        }
+    }
+    bool ok = ParseHEX((const char*)text, size);
+    munmap(text, size);
+    if (!ok) {
+        ext::LogError("Loader: %s is not a valid Intel HEX file", path.c_str());
+        return false;
+    }
+    SaveCache(cachePath, size, mtime, md5sum);
+    auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - now).count();
+    ext::LogInfo("Loader: %s parsed in %.1f ms, %d segments", path.c_str(), duration, (int)segments.size());
+    return true;
+}
+
+bool FirmwareImage::LoadCache(const std::string& path, u64 size, u64 mtime, const std::string& md5sum)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void* ptr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader)) {
+        ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    mapping = ptr;
+    mappingSize = st.st_size;
+
+    const auto* header = (const CacheHeader*)ptr;
+    bool valid = memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 && header->version == CACHE_VERSION &&
+        header->size == size && header->mtime == mtime && CacheMD5(*header) == md5sum;
+    const auto* table = (const CacheSegment*)(header + 1);
+    const u8* data = (const u8*)(table + (valid ? header->segmentCount : 0));
+    const u8* end = (const u8*)ptr + mappingSize;
+    valid = valid && data <= end;
+    for (u32 i = 0; valid && i < header->segmentCount; i++) {
+        valid = table[i].size <= (u64)(end - data);
+        segments.push_back({table[i].addr, table[i].size, data});
+        data += table[i].size;
+    }
+    if (!valid) {
+        ext::LogDebug("Loader: cache %s is stale", path.c_str());
+        segments.clear();
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void FirmwareImage::SaveCache(const std::string& path, u64 size, u64 mtime, const std::string& md5sum)
+{
+    CacheHeader header{};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.segmentCount = segments.size();
+    header.size = size;
+    header.mtime = mtime;
+    strncpy(header.md5sum, md5sum.c_str(), sizeof(header.md5sum));
+
+    auto temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+        /* a read-only firmware directory only costs the parse next time */
+        ext::LogDebug("Loader: cannot write cache %s: %s", temp.c_str(), strerror(errno));
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const auto& segment : segments) {
+        CacheSegment entry{segment.addr, segment.size};
+        ok = ok && fwrite(&entry, sizeof(entry), 1, file) == 1;
+    }
+    for (const auto& segment : segments) {
+        ok = ok && fwrite(segment.data, 1, segment.size, file) == segment.size;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        ext::LogDebug("Loader: failed to write cache %s", path.c_str());
+        unlink(temp.c_str());
+    }
+}
+
+void FirmwareImage::ParseChunk(const char* begin, const char* end, u32 base, Chunk& chunk)
+{
+    u8 record[255 + 5];
+    const char* ptr = begin;
+    while (ptr < end) {
+        const char* line = (const char*)memchr(ptr, ':', end - ptr);
+        if (!line) {
+            break;
+        }
+        u8 count;
+        if (end - line < 11 || !HexByte(line + 1, count) || end - line < 11 + count * 2) {
+            chunk.ok = false;
+            return;
+        }
+        u8 checksum = 0;
+        for (int i = 0; i < count + 5; i++) {
+            if (!HexByte(line + 1 + i * 2, record[i])) {
+                chunk.ok = false;
+                return;
+            }
+            checksum += record[i];
+        }
+        if (checksum != 0) {
+            chunk.ok = false;
+            return;
+        }
+        u32 offset = (record[1] << 8) | record[2];
+        const u8* payload = record + 4;
+        switch (record[3]) {
+        case IHEX_DATA: {
+            u32 addr = base + offset;
+            auto& runs = chunk.segments;
+            if (!runs.empty() && runs.back().addr + runs.back().size == addr) {
+                runs.back().size += count;
+            } else {
+                runs.push_back({addr, count, nullptr});
+            }
+            chunk.data.insert(chunk.data.end(), payload, payload + count);
+            break;
+        }
+        case IHEX_END_OF_FILE:
+            return;
+        case IHEX_EXTENDED_SEGMENT_ADDRESS:
+            base = ((payload[0] << 8) | payload[1]) << 4;
+            break;
+        case IHEX_EXTENDED_LINEAR_ADDRESS:
+            base = ((payload[0] << 8) | payload[1]) << 16;
+            break;
+        default:
+            break;
+        }
+        ptr = line + 11 + count * 2;
+    }
+}
+
+bool FirmwareImage::ParseHEX(const char* text, std::size_t length)
+{
+    /* address records carry state across lines, find them first so every chunk knows its starting base */
+    std::vector<std::tuple<std::size_t, u32>> bases;
+    for (const char* ptr = text; (ptr = (const char*)memmem(ptr, text + length - ptr, ":020000", 7)); ptr++) {
+        u8 type, high, low;
+        if (text + length - ptr >= 13 && HexByte(ptr + 7, type) && HexByte(ptr + 9, high) && HexByte(ptr + 11, low)) {
+            if (type == IHEX_EXTENDED_SEGMENT_ADDRESS) {
+                bases.emplace_back(ptr - text, ((high << 8) | low) << 4);
+            } else if (type == IHEX_EXTENDED_LINEAR_ADDRESS) {
+                bases.emplace_back(ptr - text, ((high << 8) | low) << 16);
+            }
+        }
+    }
+
+    int threads = std::clamp<int>(length / PARSE_CHUNK_MIN, 1, std::min<int>(PARSE_THREADS_MAX, std::max(1u, std::thread::hardware_concurrency())));
+    std::vector<std::size_t> bounds = {0};
+    for (int i = 1; i < threads; i++) {
+        std::size_t bound = std::max(bounds.back(), length * i / threads);
+        auto* newline = (const char*)memchr(text + bound, '\n', length - bound);
+        bounds.push_back(newline ? newline - text + 1 : length);
+    }
+    bounds.push_back(length);
+
+    std::vector<Chunk> chunks(threads);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        u32 base = 0;
+        for (const auto& [position, value] : bases) {
+            if (position >= bounds[i]) {
+                break;
+            }
+            base = value;
+        }
+        auto parse = [this, text, &bounds, &chunks, i, base]() { ParseChunk(text + bounds[i], text + bounds[i + 1], base, chunks[i]); };
+        if (i == threads - 1) {
+            parse();
+        } else {
+            workers.emplace_back(parse);
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::size_t total = 0;
+    for (const auto& chunk : chunks) {
+        if (!chunk.ok) {
+            return false;
+        }
+        total += chunk.data.size();
+    }
+    storage.reserve(total);
+    for (const auto& chunk : chunks) {
+        storage.insert(storage.end(), chunk.data.begin(), chunk.data.end());
+    }
+    /* chunk data was appended in order, so records continuing across a chunk boundary merge in place */
+    segments.clear();
+    std::size_t offset = 0;
+    for (const auto& chunk : chunks) {
+        for (const auto& segment : chunk.segments) {
+            if (!segments.empty() && segments.back().addr + segments.back().size == segment.addr) {
+                segments.back().size += segment.size;
+            } else {
+                segments.push_back({segment.addr, segment.size, storage.data() + offset});
+            }
+            offset += segment.size;
+        }
+    }
+    return true;
+}
+
+SharedFlash::SharedFlash(u32 base, u32 size) : base(base), size(size)
+{
+}
+
+SharedFlash::~SharedFlash()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool SharedFlash::Load(const std::string& path, const std::string& md5sum)
+{
+    if (!image.Load(path, md5sum)) {
+        return false;
+    }
+    fd = memfd_create("m8-flash", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        ext::LogError("Loader: failed to create shared flash: %s", strerror(errno));
+        return false;
+    }
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        ext::LogError("Loader: failed to map shared flash: %s", strerror(errno));
+        return false;
+    }
+    u64 end = (u64)base + size;
+    for (const auto& segment : image.Segments()) {
+        u64 segmentEnd = (u64)segment.addr + segment.size;
+        u64 begin = std::max<u64>(segment.addr, base);
+        u64 limit = std::min<u64>(segmentEnd, end);
+        if (begin < limit) {
+            memcpy((u8*)ptr + (begin - base), segment.data + (begin - segment.addr), limit - begin);
+        }
+        /* keep whatever falls outside the flash window */
+        if (segment.addr < base) {
+            segments.push_back({segment.addr, (u32)(std::min<u64>(segmentEnd, base) - segment.addr), segment.data});
+        }
+        if (segmentEnd > end) {
+            u64 start = std::max<u64>(segment.addr, end);
+            segments.push_back({(u32)start, (u32)(segmentEnd - start), segment.data + (start - segment.addr)});
+        }
+    }
+    munmap(ptr, size);
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        ext::LogDebug("Loader: failed to seal shared flash: %s", strerror(errno));
+    }
+    this->path = path;
+    return true;
+}
+
+} // namespace m8
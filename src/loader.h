@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+#include <string>
+#include <vector>
+
+namespace m8 {
+
+struct FirmwareSegment {
+    u32 addr;
+    u32 size;
+    const u8* data;
+};
+
+/*
+ * Firmware image loaded from an Intel HEX file. The HEX is mmapped and parsed
+ * in chunks across threads, checked against the md5sum from firmware.yaml and
+ * cached as a flat binary next to it, so later loads skip the parse entirely.
+ */
+class FirmwareImage {
+public:
+    FirmwareImage() = default;
+    ~FirmwareImage();
+    FirmwareImage(const FirmwareImage&) = delete;
+    FirmwareImage& operator=(const FirmwareImage&) = delete;
+
+    bool Load(const std::string& path, const std::string& md5sum);
+    const std::vector<FirmwareSegment>& Segments() const { return segments; }
+
+private:
+    struct Chunk {
+        std::vector<FirmwareSegment> segments;
+        std::vector<u8> data;
+        bool ok = true;
+    };
+
+    bool LoadCache(const std::string& path, u64 size, u64 mtime, const std::string& md5sum);
+    void SaveCache(const std::string& path, u64 size, u64 mtime, const std::string& md5sum);
+    bool ParseHEX(const char* text, std::size_t length);
+    static void ParseChunk(const char* begin, const char* end, u32 base, Chunk& chunk);
+
+    std::vector<FirmwareSegment> segments;
+    std::vector<u8> storage;
+    void* mapping = nullptr;
+    std::size_t mappingSize = 0;
+};
+
+/*
+ * Flash contents of a firmware image in a sealed memfd, every emulator in the
+ * process maps it read-only instead of keeping its own copy. Segments outside
+ * the flash window are left for each instance to copy into its own memory.
+ */
+class SharedFlash {
+public:
+    SharedFlash(u32 base, u32 size);
+    ~SharedFlash();
+    SharedFlash(const SharedFlash&) = delete;
+    SharedFlash& operator=(const SharedFlash&) = delete;
+
+    bool Load(const std::string& path, const std::string& md5sum);
+    int Fd() const { return fd; }
+    const std::string& Path() const { return path; }
+    const std::vector<FirmwareSegment>& Segments() const { return segments; }
+
+private:
+    u32 base;
+    u32 size;
+    int fd = -1;
+    std::string path;
+    FirmwareImage image;
+    std::vector<FirmwareSegment> segments;
+};
+
+} // namespace m8
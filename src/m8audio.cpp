@@ -1,52 +1,60 @@
 #include "m8audio.h"
 #include <cstddef>
+#include <algorithm>
+#include <array>
 #include <ext/disassembler.h>
 #include <ext/log.h>
 #include <ext/ir.h>
 #include "config.h"
+#include "dsp.h"
 
 using namespace std::chrono_literals;
-#define AUDIO_PROCESS_INTERVAL 1451us
-#define AUDIO_PROCESSOR_NUMS 2
+#define AUDIO_SAMPLE_RATE SAMPLE_RATE
+#define AUDIO_BLOCK_SAMPLES BLOCK_SAMPLES // one block per ~1451 us, stretched by audioClock
+#define USB_AUDIO_FRAME_BYTES 4 // 16-bit stereo
+#define USB_AUDIO_BLOCK_BYTES (AUDIO_BLOCK_SAMPLES * USB_AUDIO_FRAME_BYTES)
+#define CATCHUP_MAX_CYCLES 4 // extra cycles rendered back-to-back after one tick
+#define CATCHUP_MAX_HEADROOM 16 // blocks of latency added when catching up isn't enough
+#define CATCHUP_RECOVER_CYCLES 4096 // calm cycles before giving a block of headroom back
+#define CATCHUP_BACKOFF_CYCLES 1024 // cycles without catch-up once the headroom ceiling is reached
+#define USB_AUDIO_ENDPOINT 5
+#define MULTI_UNITYGAIN 65536
+#define MIXER_CHANNELS 4
 
 namespace m8 {
 
+void AudioStreamLayout::Load(const FirmwareConfig& config)
+{
+    active_offset = config.GetValue<u32>("AudioStream_offset_active");
+    num_inputs_offset = config.GetValue<u32>("AudioStream_offset_num_inputs");
+    next_update_offset = config.GetValue<u32>("AudioStream_offset_next_update");
+    destination_list_offset = config.GetValue<u32>("AudioStream_offset_destination_list");
+    num_inputs_mod_offset = config.GetValue<u32>("AudioStream_offset_num_inputs_mod");
+    destination_list_mod_offset = config.GetValue<u32>("AudioStream_offset_destination_list_mod");
+    inputQueue_offset = config.GetValue<u32>("AudioStream_offset_inputQueue");
+    inputQueue_mod_offset = config.GetValue<u32>("AudioStream_offset_inputQueue_mod");
+}
+
 class _AudioStream
 {
 public:
     u32 vtable() { return *(u32*)this; } // 0x00, _AudioStream::update()
-    bool active() { return *(u8*)((u8*)this + active_offset); }
-    u32 next_update_ptr() { return *(u32*)((u8*)this + next_update_offset); }
+    bool active(const AudioStreamLayout& l) { return *(u8*)((u8*)this + l.active_offset); }
+    u32 next_update_ptr(const AudioStreamLayout& l) { return *(u32*)((u8*)this + l.next_update_offset); }
 
-    u8 num_inputs() { return *(u8*)((u8*)this + (is_mod() ? num_inputs_mod_offset : num_inputs_offset)); }
-    u32 destination_list_ptr() { return *(u32*)((u8*)this + (is_mod() ? destination_list_mod_offset : destination_list_offset)); }
-    u32 inputQueue(int index) { return *(u32*)((u8*)this + (is_mod() ? inputQueue_mod_offset : inputQueue_offset)) + index * sizeof(u32); }
+    u8 num_inputs(const AudioStreamLayout& l) { return *(u8*)((u8*)this + (is_mod(l) ? l.num_inputs_mod_offset : l.num_inputs_offset)); }
+    u32 destination_list_ptr(const AudioStreamLayout& l) { return *(u32*)((u8*)this + (is_mod(l) ? l.destination_list_mod_offset : l.destination_list_offset)); }
+    u32 inputQueue(const AudioStreamLayout& l, int index) { return *(u32*)((u8*)this + (is_mod(l) ? l.inputQueue_mod_offset : l.inputQueue_offset)) + index * sizeof(u32); }
 
-    static void Initialize()
+private:
+    bool is_mod(const AudioStreamLayout& l)
     {
-        auto& config = FirmwareConfig::GlobalConfig();
-        active_offset = config.GetValue<u32>("AudioStream_offset_active");
-        num_inputs_offset = config.GetValue<u32>("AudioStream_offset_num_inputs");
-        next_update_offset = config.GetValue<u32>("AudioStream_offset_next_update");
-        destination_list_offset = config.GetValue<u32>("AudioStream_offset_destination_list");
-        num_inputs_mod_offset = config.GetValue<u32>("AudioStream_offset_num_inputs_mod");
-        destination_list_mod_offset = config.GetValue<u32>("AudioStream_offset_destination_list_mod");
-        inputQueue_offset = config.GetValue<u32>("AudioStream_offset_inputQueue");
-        inputQueue_mod_offset = config.GetValue<u32>("AudioStream_offset_inputQueue_mod");
-
+        auto iter = l.is_mod_map.find(vtable());
+        if (iter != l.is_mod_map.end()) {
+            return iter->second;
+        }
+        return *(u32*)((u8*)this + l.destination_list_offset) == 0 && *(u32*)((u8*)this + l.destination_list_mod_offset) != 0;
     }
-
-private:
-    bool is_mod() { return is_mod_map.count(vtable()) ? is_mod_map[vtable()] : *(u32*)((u8*)this + destination_list_offset) == 0 && *(u32*)((u8*)this + destination_list_mod_offset) != 0; }
-    static inline std::map<u32, bool> is_mod_map;
-    static inline u32 active_offset;
-    static inline u32 num_inputs_offset;
-    static inline u32 num_inputs_mod_offset;
-    static inline u32 next_update_offset;
-    static inline u32 destination_list_offset;
-    static inline u32 destination_list_mod_offset;
-    static inline u32 inputQueue_offset;
-    static inline u32 inputQueue_mod_offset;
 };
 
 struct __attribute__ ((packed)) _AudioConnection
@@ -75,12 +83,23 @@ struct __attribute__ ((packed)) audio_block_t {
 };
 static_assert(offsetof(audio_block_t, data) == 0x04);
 
-M8AudioProcessor::M8AudioProcessor(M8Emulator& emu) : emu(emu)
+M8AudioProcessor::M8AudioProcessor(M8Emulator& emu, int workers)
+    : emu(emu), timer(emu.TimerScheduler()), audioClock(AUDIO_SAMPLE_RATE, AUDIO_BLOCK_SAMPLES, USB_AUDIO_FRAME_BYTES)
 {
-    for (int i = 0; i < AUDIO_PROCESSOR_NUMS; i++)
-        pool.emplace_back([this]() { ProcessLoop(); });
+    layout.Load(emu.Config());
+    for (u32 update_func : emu.Config().GetValueList("AudioStream_pure_processors")) {
+        pureProcessors.insert(update_func);
+    }
+    if (pureProcessors.empty()) {
+        ext::LogInfo("AudioProcessor: no AudioStream_pure_processors, every update function runs each cycle");
+    }
+    /* every worker runs guest code on its own JIT, more than the pool holds would only queue up */
+    workers = std::clamp(workers, 1, emu.JitPoolSize());
+    executor = std::make_unique<GraphExecutor>(workers, [this](int node) { RunNode(node); });
+    ext::LogInfo("AudioProcessor: %d workers", workers);
+    emu.USBDevice().SetStreamEndpoint(USB_AUDIO_ENDPOINT);
 
-    _AudioStream::Initialize();
+    emu.AddSnapshotHandler("audio.graph", [this](StateWriter& writer) { SaveGraph(writer); }, [this](StateReader& reader) { return ParseGraph(reader); });
 }
 
 static void LockBlockWrapper(u64 ptr)
@@ -101,6 +120,18 @@ static void PushUSBAudioWrapper(u64 ptr, u64 param)
     audio->PushUSBAudioBlock(param);
 }
 
+static void BeginConnectionEditWrapper(u64 ptr, u64 connection)
+{
+    M8AudioProcessor* audio = (M8AudioProcessor*)ptr;
+    audio->BeginConnectionEdit(connection);
+}
+
+static void EndConnectionEditWrapper(u64 ptr)
+{
+    M8AudioProcessor* audio = (M8AudioProcessor*)ptr;
+    audio->EndConnectionEdit();
+}
+
 static void AddLockHook(M8AudioProcessor& audio, M8Emulator& emu, u32 begin, u32 end)
 {
     auto& callbacks = emu.Callbacks();
@@ -117,6 +148,160 @@ static void AddLockHook(M8AudioProcessor& audio, M8Emulator& emu, u32 begin, u32
     });
 }
 
+/* needs the pool symbols and AudioStream_block_samples from firmware.yaml, without them the firmware routines run under audioMutex */
+bool M8AudioProcessor::SetupBlockPool()
+{
+    const auto& config = emu.Config();
+    u32 pool_ptr = config.GetSymbolAddress("AudioStream_memory_pool");
+    u32 masks = config.GetSymbolAddress("AudioStream_memory_pool_available_mask");
+    u32 first_mask = config.GetSymbolAddress("AudioStream_memory_pool_first_mask");
+    u32 used = config.GetSymbolAddress("AudioStream_memory_used");
+    u32 used_max = config.GetSymbolAddress("AudioStream_memory_used_max");
+    if (!pool_ptr || !masks || !first_mask || !used || !used_max || !config.HasValue("AudioStream_memory_pool_masks")) {
+        return false;
+    }
+    /* the pool stride comes from the firmware build, a wrong guess would hand out overlapping blocks */
+    if (!config.HasValue("AudioStream_block_samples")) {
+        ext::LogError("AudioProcessor: AudioStream_block_samples missing, audio block pool stays in firmware");
+        return false;
+    }
+    auto& callbacks = emu.Callbacks();
+    u32 samples = config.GetValue<u32>("AudioStream_block_samples");
+    pool.base = callbacks.MemoryRead32(pool_ptr);
+    pool.blockSamples = samples;
+    pool.blockSize = sizeof(audio_block_t) + samples * sizeof(u16);
+    pool.maskCount = config.GetValue<u32>("AudioStream_memory_pool_masks");
+    pool.masks = (u32*)callbacks.MemoryMap(masks);
+    pool.firstMask = (u16*)callbacks.MemoryMap(first_mask);
+    pool.used = (u16*)callbacks.MemoryMap(used);
+    pool.usedMax = (u16*)callbacks.MemoryMap(used_max);
+    if (!pool.base || !pool.masks || !pool.firstMask || !pool.used || !pool.usedMax) {
+        ext::LogError("AudioProcessor: audio block pool not mapped (memory_pool = 0x%x)", pool.base);
+        return false;
+    }
+    ext::LogInfo("AudioProcessor: host audio block pool at 0x%x, %d masks", pool.base, pool.maskCount);
+    return true;
+}
+
+/*
+ * Same policy as AudioStream::allocate(): the highest set bit of the first
+ * non-empty mask word, claimed with a CAS. memory_pool_first_mask is only a
+ * hint here, a miss from it rescans from the start before giving up.
+ */
+u32 M8AudioProcessor::AllocateBlock()
+{
+    u32 start = __atomic_load_n(pool.firstMask, __ATOMIC_RELAXED);
+    for (u32 pass = 0; pass < 2; pass++) {
+        for (u32 index = pass ? 0 : start; index < pool.maskCount; index++) {
+            u32 avail = __atomic_load_n(&pool.masks[index], __ATOMIC_RELAXED);
+            while (avail) {
+                int n = __builtin_clz(avail);
+                u32 bit = 0x80000000u >> n;
+                if (!__atomic_compare_exchange_n(&pool.masks[index], &avail, avail & ~bit, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                    continue;
+                }
+                if (avail == bit) {
+                    u16 expected = index;
+                    __atomic_compare_exchange_n(pool.firstMask, &expected, index + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                }
+                u16 used = __atomic_add_fetch(pool.used, 1, __ATOMIC_RELAXED);
+                u16 usedMax = __atomic_load_n(pool.usedMax, __ATOMIC_RELAXED);
+                while (used > usedMax && !__atomic_compare_exchange_n(pool.usedMax, &usedMax, used, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                }
+                u32 block = pool.base + ((index << 5) + (31 - n)) * pool.blockSize;
+                auto* ptr = (audio_block_t*)emu.Callbacks().MemoryMap(block);
+                __atomic_store_n(&ptr->ref_count, 1, __ATOMIC_RELEASE);
+                return block;
+            }
+        }
+        if (!start) {
+            break;
+        }
+    }
+    return 0;
+}
+
+void M8AudioProcessor::ReleaseBlock(u32 block)
+{
+    auto* ptr = (audio_block_t*)emu.Callbacks().MemoryMap(block);
+    if (!ptr) {
+        return;
+    }
+    u8 count = __atomic_fetch_sub(&ptr->ref_count, 1, __ATOMIC_ACQ_REL);
+    if (count > 1) {
+        return;
+    }
+    __atomic_store_n(&ptr->ref_count, 0, __ATOMIC_RELAXED);
+    u32 index = ptr->memory_pool_index >> 5;
+    __atomic_fetch_or(&pool.masks[index], 1u << (ptr->memory_pool_index & 0x1F), __ATOMIC_RELEASE);
+    u16 first = __atomic_load_n(pool.firstMask, __ATOMIC_RELAXED);
+    while (index < first && !__atomic_compare_exchange_n(pool.firstMask, &first, index, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    __atomic_sub_fetch(pool.used, 1, __ATOMIC_RELAXED);
+}
+
+/* the reference is taken before the block becomes visible in the queue, a consumer may release it right away */
+void M8AudioProcessor::TransmitBlock(u32 stream_ptr, u32 block, u32 index)
+{
+    auto& callbacks = emu.Callbacks();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(stream_ptr);
+    auto* ptr = (audio_block_t*)callbacks.MemoryMap(block);
+    if (!stream || !ptr) {
+        return;
+    }
+    for (u32 connection_ptr = stream->destination_list_ptr(layout); connection_ptr;) {
+        auto* connection = (_AudioConnection*)callbacks.MemoryMap(connection_ptr);
+        if (connection->src_index == index) {
+            auto* dst = (_AudioStream*)callbacks.MemoryMap(connection->dst_ptr);
+            auto* slot = (u32*)callbacks.MemoryMap(dst->inputQueue(layout, connection->dest_index));
+            u32 expected = 0;
+            __atomic_fetch_add(&ptr->ref_count, 1, __ATOMIC_RELAXED);
+            if (!__atomic_compare_exchange_n(slot, &expected, block, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                __atomic_fetch_sub(&ptr->ref_count, 1, __ATOMIC_RELAXED);
+            }
+        }
+        connection_ptr = connection->next_dest_ptr;
+    }
+}
+
+u32 M8AudioProcessor::ReceiveWritableBlock(u32 stream_ptr, u32 index)
+{
+    auto& callbacks = emu.Callbacks();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(stream_ptr);
+    if (!stream || index >= stream->num_inputs(layout)) {
+        return 0;
+    }
+    auto* slot = (u32*)callbacks.MemoryMap(stream->inputQueue(layout, index));
+    u32 block = __atomic_exchange_n(slot, 0, __ATOMIC_ACQUIRE);
+    if (!block) {
+        return 0;
+    }
+    auto* in = (audio_block_t*)callbacks.MemoryMap(block);
+    if (__atomic_load_n(&in->ref_count, __ATOMIC_ACQUIRE) <= 1) {
+        return block;
+    }
+    /* shared: the writer gets a private copy */
+    u32 copy = AllocateBlock();
+    if (copy) {
+        auto* out = (audio_block_t*)callbacks.MemoryMap(copy);
+        memcpy(out->data, in->data, pool.blockSize - sizeof(audio_block_t));
+    }
+    ReleaseBlock(block);
+    return copy;
+}
+
+/* receiveReadOnly(): the caller owns the reference, the block may be shared */
+u32 M8AudioProcessor::ReceiveReadOnlyBlock(u32 stream_ptr, u32 index)
+{
+    auto& callbacks = emu.Callbacks();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(stream_ptr);
+    if (!stream || index >= stream->num_inputs(layout)) {
+        return 0;
+    }
+    auto* slot = (u32*)callbacks.MemoryMap(stream->inputQueue(layout, index));
+    return __atomic_exchange_n(slot, 0, __ATOMIC_ACQUIRE);
+}
+
 void M8AudioProcessor::LockAudioBlock()
 {
     audioMutex.lock();
@@ -127,9 +312,53 @@ void M8AudioProcessor::UnlockAudioBlock()
     audioMutex.unlock();
 }
 
+/*
+ * AudioConnection::connect()/disconnect() take the connection in R0. The entry
+ * remembers it and every exit queues it, the state is only read back once the
+ * firmware is done with it.
+ */
+void M8AudioProcessor::AddConnectionHook(u32 begin, u32 end)
+{
+    auto& callbacks = emu.Callbacks();
+    callbacks.AddTranslationHook(begin, [this](u32 pc, Dynarmic::A32::IREmitter& ir) {
+        ext::U64 connection(ir, ext::Reg::R0);
+        ext::CallHostFunction(ir, BeginConnectionEditWrapper, (u64)this, connection);
+    });
+    u8* code = (u8*)callbacks.MemoryMap(begin);
+    ext::DisassembleIter(code, begin, end - begin, [this, &callbacks](u32 addr, const std::string& mnemonic, const std::string& op) {
+        if (ext::IsCodeExit(mnemonic, op)) {
+            callbacks.AddTranslationHook(addr, [this](u32 pc, Dynarmic::A32::IREmitter& ir) {
+                ext::CallHostFunction(ir, EndConnectionEditWrapper, (u64)this);
+            });
+        }
+    });
+}
+
+void M8AudioProcessor::BeginConnectionEdit(u32 connection)
+{
+    editingConnection = connection;
+}
+
+void M8AudioProcessor::EndConnectionEdit()
+{
+    if (!editingConnection) {
+        return;
+    }
+    std::lock_guard lock(editMutex);
+    editedConnections.push_back(editingConnection);
+    editingConnection = 0;
+}
+
 void M8AudioProcessor::Setup()
 {
-    auto& config = FirmwareConfig::GlobalConfig();
+    auto& config = emu.Config();
+    bool hostPool = SetupBlockPool();
+    if (hostPool) {
+        LoadNativeNodes();
+    }
+    if (nativeClasses.empty() && nativeMode != NativeMode::Off) {
+        ext::LogInfo("AudioProcessor: no native audio classes for this firmware, --native-audio has no effect");
+    }
     u32 first_update = emu.Callbacks().MemoryRead32(config.GetSymbolAddress("AudioStream_first_update"));
     ParseConnections(first_update);
 
@@ -139,9 +368,32 @@ void M8AudioProcessor::Setup()
         config.GetEntryRange("AudioStream_allocate"),
         config.GetEntryRange("AudioStream_release"),
     };
-    for (const auto& range : ranges) {
-        auto [begin, end] = range;
-        AddLockHook(*this, emu, begin, end);
+    if (hostPool) {
+        emu.ReplaceFunction(std::get<0>(ranges[0]), [this](u32 stream, u32 block, u32 index, u32) {
+            TransmitBlock(stream, block, index);
+            return 0;
+        });
+        emu.ReplaceFunction(std::get<0>(ranges[1]), [this](u32 stream, u32 index, u32, u32) { return ReceiveWritableBlock(stream, index); });
+        emu.ReplaceFunction(std::get<0>(ranges[2]), [this](u32, u32, u32, u32) { return AllocateBlock(); });
+        emu.ReplaceFunction(std::get<0>(ranges[3]), [this](u32 block, u32, u32, u32) {
+            ReleaseBlock(block);
+            return 0;
+        });
+    } else {
+        for (const auto& range : ranges) {
+            auto [begin, end] = range;
+            AddLockHook(*this, emu, begin, end);
+        }
+    }
+
+    /* optional: without them the graph stays as it was at setup_done */
+    for (const auto& name : {"AudioConnection_connect", "AudioConnection_disconnect"}) {
+        auto [begin, end] = config.GetEntryRange(name);
+        if (begin && end > begin) {
+            AddConnectionHook(begin, end);
+        } else {
+            ext::LogInfo("AudioProcessor: no %s range, connection edits are not tracked", name);
+        }
     }
 
     emu.Callbacks().AddTranslationHook(config.GetSymbolAddress("AudioOutputUSB_update"), [this](u32, Dynarmic::A32::IREmitter& ir) {
@@ -149,20 +401,136 @@ void M8AudioProcessor::Setup()
         ext::CallHostFunction(ir, PushUSBAudioWrapper, (u64)this, param);
     });
 
-    timer.SetInterval(AUDIO_PROCESS_INTERVAL, [this](Timer&) {
+    /* offline: the caller drives Render(), no timer */
+    if (blockSink) {
+        return;
+    }
+
+    /* keep the graph off the shared scheduler thread, it only wakes the clock thread */
+    clockThread = std::thread([this]() { ClockLoop(); });
+    period.store(audioClock.Nominal().count(), std::memory_order_relaxed);
+    timer.SetInterval(audioClock.Nominal(), [this](Timer& timer) {
+        auto level = emu.USBDevice().GetStreamLevel(USB_AUDIO_ENDPOINT);
+        audioClock.SetHeadroom(headroomBlocks.load(std::memory_order_relaxed) * USB_AUDIO_BLOCK_BYTES);
+        auto next = audioClock.Update(level);
+        lowWater.store(audioClock.Target() / 2, std::memory_order_relaxed);
+        timer.SetPeriod(next);
+        fillHistogram.Record(level.buffered);
+        clockRatio.store(audioClock.Ratio(), std::memory_order_relaxed);
+        {
+            std::lock_guard lock(clockMutex);
+            if (clockPending) {
+                missedTicks.fetch_add(1, std::memory_order_relaxed);
+            }
+            clockPending = true;
+            period.store(next.count(), std::memory_order_relaxed);
+        }
+        clockTick.notify_one();
+    });
+    timer.Start();
+}
+
+void M8AudioProcessor::ClockLoop()
+{
+    while (running) {
+        {
+            std::unique_lock lock(clockMutex);
+            clockTick.wait(lock, [this]() { return clockPending; });
+            clockPending = false;
+        }
         auto& callbacks = emu.Callbacks();
         callbacks.lock();
         Process();
+        CatchUp();
         callbacks.unlock();
-    });
-    timer.Start();
+    }
+}
+
+void M8AudioProcessor::Render()
+{
+    auto& callbacks = emu.Callbacks();
+    blockCaptured.store(false, std::memory_order_relaxed);
+    callbacks.lock();
+    Process();
+    callbacks.unlock();
+    /* AudioOutputUSB got no input this cycle, or it was unmapped: the file still needs the time */
+    if (!blockCaptured.load(std::memory_order_acquire)) {
+        std::array<int16_t, AUDIO_BLOCK_SAMPLES * 2> silence{};
+        blockSink(silence.data(), AUDIO_BLOCK_SAMPLES);
+    }
+}
+
+/*
+ * A late tick leaves the reader short by the time it lost, render ahead until
+ * the fill is back over the low-water mark. When the bounded burst can't get
+ * there, hold more latency. At the ceiling the host can't keep up at all, so
+ * the bursts only add load: shed the checking work and stop rendering ahead
+ * for a while.
+ */
+void M8AudioProcessor::CatchUp()
+{
+    auto level = emu.USBDevice().GetStreamLevel(USB_AUDIO_ENDPOINT);
+    /* only while someone reads the stream, an idle or absent sink has nothing to catch up with */
+    bool reading = level.consumed != catchUpConsumed || level.underruns != catchUpUnderruns;
+    catchUpConsumed = level.consumed;
+    catchUpUnderruns = level.underruns;
+    if (backoffCycles) {
+        backoffCycles--;
+        backedOffCycles.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    u64 mark = lowWater.load(std::memory_order_relaxed);
+    int extra = 0;
+    while (reading && level.buffered < mark) {
+        if (extra == CATCHUP_MAX_CYCLES) {
+            Degrade();
+            return;
+        }
+        Process();
+        extra++;
+        catchUpCycles.fetch_add(1, std::memory_order_relaxed);
+        level = emu.USBDevice().GetStreamLevel(USB_AUDIO_ENDPOINT);
+    }
+    u32 headroom = headroomBlocks.load(std::memory_order_relaxed);
+    if (headroom && ++calmCycles >= CATCHUP_RECOVER_CYCLES) {
+        headroomBlocks.store(headroom - 1, std::memory_order_relaxed);
+        calmCycles = 0;
+    }
+}
+
+void M8AudioProcessor::Degrade()
+{
+    calmCycles = 0;
+    u32 headroom = headroomBlocks.load(std::memory_order_relaxed);
+    if (headroom < CATCHUP_MAX_HEADROOM) {
+        headroomBlocks.store(headroom + 1, std::memory_order_relaxed);
+        ext::LogDebug("AudioProcessor: falling behind, holding %d blocks of extra latency", headroom + 1);
+        return;
+    }
+    if (nativeMode == NativeMode::Compare && !nativeClasses.empty()) {
+        ext::LogInfo("AudioProcessor: falling behind, native audio objects no longer compared");
+        nativeMode = NativeMode::On;
+    }
+    if (!silenceElision && !pureProcessors.empty()) {
+        ext::LogInfo("AudioProcessor: falling behind, silence elision enabled");
+        silenceElision = true;
+    }
+    backoffCycles = CATCHUP_BACKOFF_CYCLES;
+    u64 count = saturations.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (count == 1) {
+        ext::LogInfo("AudioProcessor: falling behind with %d blocks of extra latency, no catch-up for %d cycles", headroom, CATCHUP_BACKOFF_CYCLES);
+    } else {
+        ext::LogDebug("AudioProcessor: falling behind again (%llu times), no catch-up for %d cycles", (unsigned long long)count, CATCHUP_BACKOFF_CYCLES);
+    }
 }
 
 #define PIPELINE(ptr) pipelineMap[ptr]
 
 void M8AudioProcessor::ParseConnections(u32 first_update)
 {
+    /* restored from a snapshot, only the node classes may have changed */
     if (!pipelineMap.empty()) {
+        CompileSchedule();
         return;
     }
     auto& callbacks = emu.Callbacks();
@@ -170,121 +538,464 @@ void M8AudioProcessor::ParseConnections(u32 first_update)
     while (ptr) {
         auto* stream = (_AudioStream*)callbacks.MemoryMap(ptr);
         u32 update_func = callbacks.MemoryRead32(stream->vtable());
-        ext::LogDebug("_AudioStream(0x%x): update(0x%x), num_inputs = %d, active = %s", ptr, update_func, stream->num_inputs(), stream->active() ? "true" : "false");
-        if (!stream->active()) {
-            ptr = stream->next_update_ptr();
-            continue;
-        }
+        ext::LogDebug("_AudioStream(0x%x): update(0x%x), num_inputs = %d, active = %s", ptr, update_func, stream->num_inputs(layout), stream->active(layout) ? "true" : "false");
+        /* inactive streams are scheduled too, RunNode skips them while the flag is clear */
         auto& pipeline = PIPELINE(ptr);
         pipeline.index = pipelines.size();
         pipeline.this_ptr = ptr;
         pipeline.update_func = update_func;
         pipelines.push_back(ptr);
-        ptr = stream->destination_list_ptr();
-        while (ptr) {
-            auto* connection = (_AudioConnection*)callbacks.MemoryMap(ptr);
-            ext::LogDebug("\t_AudioConnection(0x%x): 0x%x(%d) -> 0x%x(%d) %s", ptr, connection->src_ptr, connection->src_index, connection->dst_ptr, connection->dest_index, connection->isConnected ? "connected" : "");
-            if (connection->isConnected) {
-                pipeline.outputs.emplace((u32)connection->dst_ptr, connection->dest_index);
-                PIPELINE(connection->dst_ptr).inputs.emplace((u32)connection->src_ptr, connection->src_index);
+        ptr = stream->next_update_ptr(layout);
+    }
+    for (u32 stream : pipelines) {
+        LinkOutputs(stream);
+    }
+    CompileSchedule();
+}
+
+/* the connected entries of a stream's destination list that lead to a scheduled stream, both ends of each edge */
+void M8AudioProcessor::LinkOutputs(u32 stream_ptr)
+{
+    auto& callbacks = emu.Callbacks();
+    u32 ptr = ((_AudioStream*)callbacks.MemoryMap(stream_ptr))->destination_list_ptr(layout);
+    while (ptr) {
+        auto* connection = (_AudioConnection*)callbacks.MemoryMap(ptr);
+        ext::LogDebug("\t_AudioConnection(0x%x): 0x%x(%d) -> 0x%x(%d) %s", ptr, connection->src_ptr, connection->src_index, connection->dst_ptr, connection->dest_index, connection->isConnected ? "connected" : "");
+        if (connection->isConnected && pipelineMap.count(connection->dst_ptr)) {
+            PIPELINE(stream_ptr).outputs.emplace((u32)connection->dst_ptr, connection->dest_index);
+            PIPELINE(connection->dst_ptr).inputs.emplace((u32)connection->src_ptr, connection->src_index);
+        }
+        ptr = connection->next_dest_ptr;
+    }
+}
+
+void M8AudioProcessor::SaveGraph(StateWriter& writer)
+{
+    writer.Write<u32>(pipelines.size());
+    for (u32 ptr : pipelines) {
+        const auto& pipeline = PIPELINE(ptr);
+        writer.Write(pipeline.this_ptr);
+        writer.Write(pipeline.update_func);
+        for (const auto* links : {&pipeline.inputs, &pipeline.outputs}) {
+            writer.Write<u32>(links->size());
+            for (auto [link_ptr, index] : *links) {
+                writer.Write(link_ptr);
+                writer.Write(index);
             }
-            ptr = connection->next_dest_ptr;
         }
-        ptr = stream->next_update_ptr();
     }
-    pipelineFinished.resize(pipelines.size());
 }
 
-void M8AudioProcessor::ProcessLoop()
+StateLoader M8AudioProcessor::ParseGraph(StateReader& reader)
 {
-    while (running) {
-        u32 ptr = 0;
-        {
-            std::unique_lock lock(workMutex);
-            workReady.wait(lock, [this]() { return !readyPipelines.empty(); });
-            ptr = *readyPipelines.begin();
-            readyPipelines.erase(ptr);
-            visitedPipelines.insert(ptr);
+    std::vector<u32> order;
+    std::map<u32, AudioPipeline> graph;
+    u32 count = reader.Read<u32>();
+    for (u32 i = 0; i < count && reader.Ok(); i++) {
+        u32 ptr = reader.Read<u32>();
+        auto& pipeline = graph[ptr];
+        pipeline.index = i;
+        pipeline.this_ptr = ptr;
+        pipeline.update_func = reader.Read<u32>();
+        for (auto* links : {&pipeline.inputs, &pipeline.outputs}) {
+            u32 size = reader.Read<u32>();
+            for (u32 j = 0; j < size && reader.Ok(); j++) {
+                u32 link_ptr = reader.Read<u32>();
+                int index = reader.Read<int>();
+                links->emplace(link_ptr, index);
+            }
         }
+        order.push_back(ptr);
+    }
+    if (!reader.Done()) {
+        return {};
+    }
+    return [this, order = std::move(order), graph = std::move(graph)]() mutable {
+        pipelines = std::move(order);
+        pipelineMap = std::move(graph);
+        CompileSchedule();
+    };
+}
 
-        auto& pipeline = PIPELINE(ptr);
-        emu.CallFunction1(pipeline.update_func, pipeline.this_ptr);
-
-        std::unique_lock lock(workMutex);
-        finishedPipelines.insert(ptr);
-        for (auto [dst_ptr, _] : pipeline.outputs) {
-            bool ready = !visitedPipelines.count(dst_ptr) && !readyPipelines.count(dst_ptr);
-            if (ready) {
-                for (auto [src_ptr, __] : PIPELINE(dst_ptr).inputs) {
-                    if (PIPELINE(src_ptr).index < PIPELINE(dst_ptr).index && !finishedPipelines.count(src_ptr)) {
-                        ready = false;
-                        break;
-                    }
+/*
+ * Nodes run in update list order unless the graph says otherwise: for every
+ * connection the node later in the list waits for the earlier one, whichever
+ * way the audio flows (a feedback destination must have consumed its input
+ * before the source overwrites it).
+ */
+void M8AudioProcessor::CompileSchedule()
+{
+    /* measured costs survive a recompile, so an edit doesn't reset the priorities */
+    std::map<u32, double> measured;
+    for (int i = 0; i < schedule.size(); i++) {
+        measured[schedule[i].this_ptr] = executor->Cost(i);
+    }
+    std::map<u32, int> order;
+    schedule.clear();
+    for (u32 ptr : pipelines) {
+        PIPELINE(ptr).index = schedule.size();
+        order[ptr] = schedule.size();
+        u32 update_func = PIPELINE(ptr).update_func;
+        auto native = nativeClasses.find(update_func & ~1);
+        schedule.push_back({ptr, update_func, pureProcessors.count(update_func) > 0, native != nativeClasses.end() ? &native->second : nullptr});
+    }
+    std::vector<std::tuple<int, int>> edges;
+    for (u32 ptr : pipelines) {
+        int index = order[ptr];
+        const auto& pipeline = PIPELINE(ptr);
+        for (const auto* links : {&pipeline.inputs, &pipeline.outputs}) {
+            for (auto [link_ptr, _] : *links) {
+                auto iter = order.find(link_ptr);
+                if (iter != order.end() && iter->second < index) {
+                    edges.emplace_back(iter->second, index);
                 }
             }
-            if (ready) {
-                for (auto [out_ptr, __] : PIPELINE(dst_ptr).outputs) {
-                    if (PIPELINE(out_ptr).index < PIPELINE(dst_ptr).index && !finishedPipelines.count(out_ptr)) {
-                        ready = false;
-                        break;
-                    }
+        }
+    }
+    std::vector<double> costs;
+    for (const auto& node : schedule) {
+        auto iter = measured.find(node.this_ptr);
+        costs.push_back(iter != measured.end() ? iter->second : 0);
+    }
+    executor->Compile(schedule.size(), edges, costs);
+    ext::LogDebug("AudioProcessor: schedule compiled, %d nodes, %d edges", (int)schedule.size(), (int)edges.size());
+}
+
+/* sources have no inputs and are never silent, a processor is when no upstream node transmitted a block */
+bool M8AudioProcessor::InputsSilent(u32 ptr)
+{
+    auto& callbacks = emu.Callbacks();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(ptr);
+    int inputs = stream->num_inputs(layout);
+    if (!inputs) {
+        return false;
+    }
+    for (int i = 0; i < inputs; i++) {
+        if (callbacks.MemoryRead32(stream->inputQueue(layout, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void M8AudioProcessor::RunNode(int node)
+{
+    const auto& scheduled = schedule[node];
+    if (!((_AudioStream*)emu.Callbacks().MemoryMap(scheduled.this_ptr))->active(layout)) {
+        return;
+    }
+    if (silenceElision && scheduled.pure && InputsSilent(scheduled.this_ptr)) {
+        skippedCalls.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (scheduled.native && nativeMode == NativeMode::On) {
+        RunNative(scheduled);
+    } else if (scheduled.native && nativeMode == NativeMode::Compare) {
+        CompareNative(scheduled);
+    } else {
+        emu.CallFunction1(scheduled.update_func, scheduled.this_ptr);
+    }
+}
+
+/* update functions and multiplier offsets of the stock classes, from firmware.yaml */
+void M8AudioProcessor::LoadNativeNodes()
+{
+    const auto& config = emu.Config();
+    const std::tuple<const char*, const char*, NativeKind> classes[] = {
+        {"AudioMixer4_update", "AudioMixer4_offset_multiplier", NativeKind::Mixer},
+        {"AudioAmplifier_update", "AudioAmplifier_offset_multiplier", NativeKind::Amplifier},
+        {"AudioEffectMultiply_update", nullptr, NativeKind::Multiply},
+    };
+    for (auto [symbol, offset, kind] : classes) {
+        u32 update_func = config.GetSymbolAddress(symbol);
+        if (!update_func || (offset && !config.HasValue(offset))) {
+            continue;
+        }
+        nativeClasses[update_func & ~1] = {kind, offset ? config.GetValue<u32>(offset) : 0};
+        ext::LogInfo("AudioProcessor: %s runs natively", symbol);
+    }
+}
+
+static int32_t NativeMultiplier(_AudioStream* stream, u32 offset, int channel)
+{
+    return *(int32_t*)((u8*)stream + offset + channel * sizeof(int32_t));
+}
+
+/* AudioMixer4, AudioAmplifier and AudioEffectMultiply update() on the guest blocks */
+void M8AudioProcessor::RunNative(const ScheduledNode& node)
+{
+    auto& callbacks = emu.Callbacks();
+    const auto& kernels = HostDSPKernels();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(node.this_ptr);
+    auto data = [&callbacks](u32 block) { return (int16_t*)((audio_block_t*)callbacks.MemoryMap(block))->data; };
+    u32 samples = pool.blockSamples;
+
+    switch (node.native->kind) {
+    case NativeKind::Mixer: {
+        u32 out = 0;
+        for (int channel = 0; channel < MIXER_CHANNELS; channel++) {
+            int32_t mult = NativeMultiplier(stream, node.native->multiplierOffset, channel);
+            if (!out) {
+                out = ReceiveWritableBlock(node.this_ptr, channel);
+                if (out && mult != MULTI_UNITYGAIN) {
+                    kernels.gainQ15(data(out), mult, data(out), samples);
                 }
+            } else if (u32 in = ReceiveReadOnlyBlock(node.this_ptr, channel)) {
+                kernels.gainAddQ15(data(in), mult, data(out), samples);
+                ReleaseBlock(in);
             }
-            if (ready) {
-                readyPipelines.insert(dst_ptr);
-                workReady.notify_all();
+        }
+        if (out) {
+            TransmitBlock(node.this_ptr, out, 0);
+            ReleaseBlock(out);
+        }
+        break;
+    }
+    case NativeKind::Amplifier: {
+        int32_t mult = NativeMultiplier(stream, node.native->multiplierOffset, 0);
+        u32 block = mult == 0 || mult == MULTI_UNITYGAIN ? ReceiveReadOnlyBlock(node.this_ptr, 0) : ReceiveWritableBlock(node.this_ptr, 0);
+        if (!block) {
+            break;
+        }
+        if (mult != 0) {
+            if (mult != MULTI_UNITYGAIN) {
+                kernels.gainQ15(data(block), mult, data(block), samples);
             }
+            TransmitBlock(node.this_ptr, block, 0);
+        }
+        ReleaseBlock(block);
+        break;
+    }
+    case NativeKind::Multiply: {
+        u32 a = ReceiveWritableBlock(node.this_ptr, 0);
+        u32 b = ReceiveReadOnlyBlock(node.this_ptr, 1);
+        if (a && b) {
+            kernels.multQ15(data(a), data(b), data(a), samples);
+            TransmitBlock(node.this_ptr, a, 0);
+        }
+        if (a) {
+            ReleaseBlock(a);
+        }
+        if (b) {
+            ReleaseBlock(b);
+        }
+        break;
+    }
+    }
+}
+
+/*
+ * Compare mode: the guest update runs as usual and the host result computed
+ * from copies of the same inputs is checked against the block it transmitted.
+ */
+void M8AudioProcessor::CompareNative(const ScheduledNode& node)
+{
+    auto& callbacks = emu.Callbacks();
+    const auto& kernels = HostDSPKernels();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(node.this_ptr);
+    u32 samples = pool.blockSamples;
+    int numInputs = stream->num_inputs(layout);
+    std::vector<std::vector<int16_t>> inputs(numInputs);
+    for (int i = 0; i < numInputs; i++) {
+        if (u32 block = callbacks.MemoryRead32(stream->inputQueue(layout, i))) {
+            auto* ptr = (int16_t*)((audio_block_t*)callbacks.MemoryMap(block))->data;
+            inputs[i].assign(ptr, ptr + samples);
+        }
+    }
+    std::vector<int32_t> mults;
+    for (int channel = 0; node.native->kind != NativeKind::Multiply && channel < (node.native->kind == NativeKind::Mixer ? MIXER_CHANNELS : 1); channel++) {
+        mults.push_back(NativeMultiplier(stream, node.native->multiplierOffset, channel));
+    }
+
+    emu.CallFunction1(node.update_func, node.this_ptr);
+
+    std::vector<int16_t> expected;
+    switch (node.native->kind) {
+    case NativeKind::Mixer:
+        for (int channel = 0; channel < MIXER_CHANNELS && channel < numInputs; channel++) {
+            if (inputs[channel].empty()) {
+                continue;
+            }
+            if (expected.empty()) {
+                expected.resize(samples);
+                kernels.gainQ15(inputs[channel].data(), mults[channel], expected.data(), samples);
+            } else {
+                kernels.gainAddQ15(inputs[channel].data(), mults[channel], expected.data(), samples);
+            }
+        }
+        break;
+    case NativeKind::Amplifier:
+        if (numInputs && !inputs[0].empty() && mults[0] != 0) {
+            expected.resize(samples);
+            kernels.gainQ15(inputs[0].data(), mults[0], expected.data(), samples);
+        }
+        break;
+    case NativeKind::Multiply:
+        if (numInputs > 1 && !inputs[0].empty() && !inputs[1].empty()) {
+            expected.resize(samples);
+            kernels.multQ15(inputs[0].data(), inputs[1].data(), expected.data(), samples);
+        }
+        break;
+    }
+
+    const int16_t* actual = nullptr;
+    for (u32 ptr = stream->destination_list_ptr(layout); ptr && !actual;) {
+        auto* connection = (_AudioConnection*)callbacks.MemoryMap(ptr);
+        auto* dst = (_AudioStream*)callbacks.MemoryMap(connection->dst_ptr);
+        if (connection->src_index == 0) {
+            if (u32 block = callbacks.MemoryRead32(dst->inputQueue(layout, connection->dest_index))) {
+                actual = (int16_t*)((audio_block_t*)callbacks.MemoryMap(block))->data;
+            }
+        }
+        ptr = connection->next_dest_ptr;
+    }
+    if (!stream->destination_list_ptr(layout)) {
+        return;
+    }
+    nativeCompared.fetch_add(1, std::memory_order_relaxed);
+    bool match = expected.empty() ? !actual : actual && memcmp(actual, expected.data(), samples * sizeof(int16_t)) == 0;
+    if (!match) {
+        u64 mismatches = nativeMismatches.fetch_add(1, std::memory_order_relaxed) + 1;
+        int offset = 0;
+        while (actual && !expected.empty() && offset < samples && actual[offset] == expected[offset]) {
+            offset++;
         }
-        pipelineFinished[pipeline.index] = true;
-        for (int i = 0; i < pipelineFinished.size(); i++) {
-            if (!pipelineFinished[i]) {
-                if (!visitedPipelines.count(pipelines[i]) && !readyPipelines.count(pipelines[i])) {
-                    readyPipelines.insert(pipelines[i]);
-                    workReady.notify_all();
+        ext::LogError("AudioProcessor: native update(0x%x) of 0x%x differs at sample %d (%llu of %llu blocks)", node.update_func, node.this_ptr,
+            actual && !expected.empty() ? offset : -1, (unsigned long long)mismatches, (unsigned long long)nativeCompared.load(std::memory_order_relaxed));
+    }
+}
+
+/* node order in the update list decides edge direction, a new node goes before its first scheduled successor */
+void M8AudioProcessor::AddPipeline(u32 ptr)
+{
+    auto& callbacks = emu.Callbacks();
+    auto* stream = (_AudioStream*)callbacks.MemoryMap(ptr);
+    auto& pipeline = PIPELINE(ptr);
+    pipeline.this_ptr = ptr;
+    pipeline.update_func = callbacks.MemoryRead32(stream->vtable());
+    u32 next = stream->next_update_ptr(layout);
+    while (next && !pipelineMap.count(next)) {
+        next = ((_AudioStream*)callbacks.MemoryMap(next))->next_update_ptr(layout);
+    }
+    auto position = next ? std::find(pipelines.begin(), pipelines.end(), next) : pipelines.end();
+    pipelines.insert(position, ptr);
+    /* every connection already made to or from it, not only the one being edited */
+    for (u32 source : pipelines) {
+        LinkOutputs(source);
+    }
+    ext::LogDebug("AudioProcessor: added _AudioStream(0x%x), update(0x%x)", ptr, pipeline.update_func);
+}
+
+/* only the streams at both ends of an edited connection are touched */
+void M8AudioProcessor::ApplyConnectionEdits()
+{
+    std::vector<u32> edited;
+    {
+        std::lock_guard lock(editMutex);
+        edited.swap(editedConnections);
+    }
+    bool changed = false;
+    auto& callbacks = emu.Callbacks();
+    for (u32 ptr : edited) {
+        auto* connection = (_AudioConnection*)callbacks.MemoryMap(ptr);
+        u32 src = connection->src_ptr;
+        u32 dst = connection->dst_ptr;
+        if (!src || !dst) {
+            continue;
+        }
+        ext::LogDebug("AudioProcessor: _AudioConnection(0x%x): 0x%x(%d) -> 0x%x(%d) %s", ptr, src, connection->src_index, dst, connection->dest_index, connection->isConnected ? "connected" : "disconnected");
+        if (connection->isConnected) {
+            for (u32 stream : {src, dst}) {
+                if (!pipelineMap.count(stream)) {
+                    AddPipeline(stream);
                 }
-                break;
+            }
+            PIPELINE(src).outputs.emplace(dst, connection->dest_index);
+            PIPELINE(dst).inputs.emplace(src, connection->src_index);
+        } else {
+            if (pipelineMap.count(src)) {
+                PIPELINE(src).outputs.erase({dst, connection->dest_index});
+            }
+            if (pipelineMap.count(dst)) {
+                PIPELINE(dst).inputs.erase({src, connection->src_index});
             }
         }
-        workDone.notify_one();
+        changed = true;
+    }
+    if (changed) {
+        CompileSchedule();
     }
 }
 
 void M8AudioProcessor::Process()
 {
+    ApplyConnectionEdits();
     auto now = std::chrono::steady_clock::now();
-    std::unique_lock lock(workMutex);
-    for (const auto& [ptr, pipeline] : pipelineMap) {
-        if (pipeline.inputs.empty() || pipeline.index == 0) {
-            readyPipelines.insert(pipeline.this_ptr);
-        }
+    auto cycles = emu.Callbacks().Cycles();
+    executor->Run();
+    u64 skipped = skippedCalls.exchange(0, std::memory_order_relaxed);
+    totalSkipped += skipped;
+    totalCalls += schedule.size();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+    cycles = emu.Callbacks().Cycles() - cycles;
+    durationHistogram.Record(duration);
+    processedCycles.fetch_add(1, std::memory_order_relaxed);
+    if ((u64)duration > period.load(std::memory_order_relaxed)) {
+        deadlineMisses.fetch_add(1, std::memory_order_relaxed);
     }
-    workReady.notify_all();
-    workDone.wait(lock, [this] () { return finishedPipelines.size() == pipelineMap.size(); });
+    ext::LogDebug("AudioProcessor duration = %d us (critical path %.1f us), %llu instructions (%.1f MIPS), %d/%d nodes skipped (%.1f%% overall)", duration,
+        executor->CriticalPath() / 1000, (unsigned long long)cycles, duration ? (double)cycles / duration : 0.0, (int)skipped, (int)schedule.size(),
+        totalCalls ? 100.0 * totalSkipped / totalCalls : 0.0);
+}
 
-    readyPipelines.clear();
-    finishedPipelines.clear();
-    visitedPipelines.clear();
-    for (int i = 0; i < pipelineFinished.size(); i++) {
-        pipelineFinished[i] = false;
-    }
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
-    ext::LogDebug("AudioProcessor duration = %d us", duration);
+M8AudioProcessor::Stats M8AudioProcessor::GetStats()
+{
+    auto level = emu.USBDevice().GetStreamLevel(USB_AUDIO_ENDPOINT);
+    Stats stats;
+    stats.cycles = processedCycles.load(std::memory_order_relaxed);
+    stats.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+    stats.missedTicks = missedTicks.load(std::memory_order_relaxed);
+    stats.durationMean = durationHistogram.Mean();
+    stats.durationP99 = durationHistogram.Percentile(99);
+    stats.durationMax = durationHistogram.Max();
+    stats.fillMin = fillHistogram.Percentile(0);
+    stats.fillP50 = fillHistogram.Percentile(50);
+    stats.fillMax = fillHistogram.Max();
+    stats.fillCapacity = level.capacity;
+    stats.droppedBytes = level.dropped;
+    stats.underruns = level.underruns;
+    stats.catchUpCycles = catchUpCycles.load(std::memory_order_relaxed);
+    stats.headroomBlocks = headroomBlocks.load(std::memory_order_relaxed);
+    stats.saturations = saturations.load(std::memory_order_relaxed);
+    stats.backedOffCycles = backedOffCycles.load(std::memory_order_relaxed);
+    stats.clockRatio = clockRatio.load(std::memory_order_relaxed);
+    return stats;
 }
 
+/* runs on whichever worker updates AudioOutputUSB, one at a time: the single producer of the endpoint ring */
 void M8AudioProcessor::PushUSBAudioBlock(u32 ptr)
 {
     auto& callbacks = emu.Callbacks();
     auto* stream = (_AudioStream*)callbacks.MemoryMap(ptr);
-    std::lock_guard lock(audioMutex);
-    auto* left_audio = (audio_block_t*)callbacks.MemoryMap(callbacks.MemoryRead32(stream->inputQueue(0)));
-    auto* right_audio = (audio_block_t*)callbacks.MemoryMap(callbacks.MemoryRead32(stream->inputQueue(1)));
-    u16* left = left_audio->data;
-    u16* right = right_audio->data;
-    std::vector<u32> buffer(64);
-    for (int i = 0; i < buffer.size(); i++) {
-        buffer[i] = (*right++ << 16) | (*left++ & 0xFFFF);
-    }
-    emu.USBDevice().PushData(5, (u8*)buffer.data(), buffer.size() * sizeof(u32));
+    /* an empty slot is 0, which would map to ITCM: like AudioOutputUSB::update, one missing channel reuses the other */
+    u32 left_block = callbacks.MemoryRead32(stream->inputQueue(layout, 0));
+    u32 right_block = callbacks.MemoryRead32(stream->inputQueue(layout, 1));
+    if (!left_block && !right_block) {
+        return;
+    }
+    auto* left_audio = (audio_block_t*)callbacks.MemoryMap(left_block ? left_block : right_block);
+    auto* right_audio = (audio_block_t*)callbacks.MemoryMap(right_block ? right_block : left_block);
+    if (!left_audio || !right_audio) {
+        return;
+    }
+    std::array<int16_t, AUDIO_BLOCK_SAMPLES * 2> frames;
+    HostDSPKernels().interleaveQ15((const int16_t*)left_audio->data, (const int16_t*)right_audio->data, frames.data(), AUDIO_BLOCK_SAMPLES);
+    if (blockSink) {
+        blockSink(frames.data(), AUDIO_BLOCK_SAMPLES);
+        blockCaptured.store(true, std::memory_order_release);
+        return;
+    }
+    emu.USBDevice().PushData(USB_AUDIO_ENDPOINT, (u8*)frames.data(), sizeof(frames));
 }
 
 } // namespace m8
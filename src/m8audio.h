@@ -7,9 +7,27 @@
 #include <condition_variable>
 #include "m8emu.h"
 #include "timer.h"
+#include "executor.h"
+#include "audioclock.h"
+#include "stats.h"
 
 namespace m8 {
 
+/* firmware specific _AudioStream field offsets from firmware.yaml */
+struct AudioStreamLayout {
+    void Load(const FirmwareConfig& config);
+
+    std::map<u32, bool> is_mod_map;
+    u32 active_offset = 0;
+    u32 num_inputs_offset = 0;
+    u32 num_inputs_mod_offset = 0;
+    u32 next_update_offset = 0;
+    u32 destination_list_offset = 0;
+    u32 destination_list_mod_offset = 0;
+    u32 inputQueue_offset = 0;
+    u32 inputQueue_mod_offset = 0;
+};
+
 struct AudioPipeline {
     int index;
     u32 this_ptr;
@@ -20,36 +38,162 @@ struct AudioPipeline {
 
 class M8AudioProcessor {
 public:
-    M8AudioProcessor(M8Emulator& emu);
+    static constexpr int DEFAULT_WORKERS = 2;
+    static constexpr int SAMPLE_RATE = 44100;
+    static constexpr int BLOCK_SAMPLES = 64;
+
+    /* interleaved 16-bit stereo frames of one AudioOutputUSB block */
+    using BlockSink = std::function<void(const int16_t* frames, std::size_t count)>;
+
+    /* stock Teensy Audio objects run as host code, or run as guest code and are checked against it */
+    enum class NativeMode { Off, On, Compare };
+
+    /* counters since Setup(), durations in us and fill levels in bytes of the USB audio endpoint */
+    struct Stats {
+        u64 cycles;
+        u64 deadlineMisses; // Process() took longer than the period it was started for
+        u64 missedTicks;    // the timer fired while the previous cycle was still pending
+        u64 durationMean;
+        u64 durationP99;
+        u64 durationMax;
+        u64 fillMin;
+        u64 fillP50;
+        u64 fillMax;
+        u64 fillCapacity;
+        u64 droppedBytes;
+        u64 underruns;
+        u64 catchUpCycles;  // extra cycles rendered to refill the endpoint
+        u64 headroomBlocks; // latency currently added on top of the target
+        u64 saturations;    // times the headroom ceiling was reached and catch-up suspended
+        u64 backedOffCycles; // cycles run without catch-up while suspended
+        double clockRatio;
+    };
+
+    M8AudioProcessor(M8Emulator& emu, int workers = DEFAULT_WORKERS);
+    void SetSilenceElision(bool enabled) { silenceElision = enabled; }
+    void SetNativeMode(NativeMode mode) { nativeMode = mode; }
+    /* USB audio buffered ahead of the host, held by trimming the processing period */
+    void SetTargetLatency(std::chrono::microseconds latency) { audioClock.SetTargetLatency(latency); }
+    /* offline rendering: no timer or USB stream, the caller runs Render() once per block */
+    void SetOffline(BlockSink sink) { blockSink = std::move(sink); }
     void Setup();
     void Process();
+    void Render();
+    Stats GetStats();
+    const Histogram& ProcessDuration() const { return durationHistogram; }
+    const Histogram& StreamFill() const { return fillHistogram; }
 
     void LockAudioBlock();
     void UnlockAudioBlock();
     void PushUSBAudioBlock(u32 stream);
+    void BeginConnectionEdit(u32 connection);
+    void EndConnectionEdit();
 
 private:
     void ParseConnections(u32 first_update);
-    void ProcessLoop();
+    void SaveGraph(StateWriter& writer);
+    StateLoader ParseGraph(StateReader& reader);
+    void AddConnectionHook(u32 begin, u32 end);
+    void ApplyConnectionEdits();
+    void AddPipeline(u32 ptr);
+    void LinkOutputs(u32 stream);
+    bool SetupBlockPool();
+    u32 AllocateBlock();
+    void ReleaseBlock(u32 block);
+    void TransmitBlock(u32 stream, u32 block, u32 index);
+    u32 ReceiveWritableBlock(u32 stream, u32 index);
+    u32 ReceiveReadOnlyBlock(u32 stream, u32 index);
+    void CompileSchedule();
+    void RunNode(int node);
+    bool InputsSilent(u32 ptr);
+    void LoadNativeNodes();
+    void ClockLoop();
+    void CatchUp();
+    void Degrade();
 
 private:
     M8Emulator& emu;
+    AudioStreamLayout layout;
     bool running = true;
-    std::mutex workMutex;
-    std::condition_variable workReady;
-    std::condition_variable workDone;
-    std::vector<std::thread> pool;
     std::recursive_mutex audioMutex;
+
+    /* the firmware's audio_block_t pool, handed out by the host with atomics instead of audioMutex */
+    struct BlockPool {
+        u32 base = 0;
+        u32 blockSize = 0;
+        u32 blockSamples = 0;
+        u32 maskCount = 0;
+        u32* masks = nullptr;
+        u16* firstMask = nullptr;
+        u16* used = nullptr;
+        u16* usedMax = nullptr;
+    } pool;
     Timer timer;
+    AudioClock audioClock; // only touched from the timer callback after Setup()
+    std::thread clockThread;
+    std::mutex clockMutex;
+    std::condition_variable clockTick;
+    bool clockPending = false;
+    BlockSink blockSink;
+    std::atomic<bool> blockCaptured{false}; // set by the worker that ran AudioOutputUSB, only for a real block
+
+    std::atomic<u64> period{0};
+    std::atomic<u64> processedCycles{0};
+    std::atomic<u64> deadlineMisses{0};
+    std::atomic<u64> missedTicks{0};
+    std::atomic<double> clockRatio{1};
+    Histogram durationHistogram;
+    Histogram fillHistogram;
+
+    std::atomic<u64> lowWater{0};
+    std::atomic<u32> headroomBlocks{0};
+    std::atomic<u64> catchUpCycles{0};
+    u64 catchUpConsumed = 0;
+    u64 catchUpUnderruns = 0;
+    u32 calmCycles = 0;
+    u32 backoffCycles = 0;
+    std::atomic<u64> saturations{0};
+    std::atomic<u64> backedOffCycles{0};
+
+    /* update funcs which only transform their inputs, skipped while every input is null */
+    std::set<u32> pureProcessors;
+    bool silenceElision = true;
+    std::atomic<u64> skippedCalls{0};
+    u64 totalCalls = 0;
+    u64 totalSkipped = 0;
+
+    enum class NativeKind { Mixer, Amplifier, Multiply };
+    struct NativeClass {
+        NativeKind kind;
+        u32 multiplierOffset;
+    };
+    /* by update_func, needs the host block pool */
+    std::map<u32, NativeClass> nativeClasses;
+    NativeMode nativeMode = NativeMode::On;
+    std::atomic<u64> nativeCompared{0};
+    std::atomic<u64> nativeMismatches{0};
 
     std::vector<u32> pipelines;
     std::map<u32, AudioPipeline> pipelineMap;
 
+    /* connections edited by the firmware, applied before the next cycle */
+    u32 editingConnection = 0;
+    std::mutex editMutex;
+    std::vector<u32> editedConnections;
+
 private:
-    std::vector<bool> pipelineFinished;
-    std::set<u32> readyPipelines;
-    std::set<u32> visitedPipelines;
-    std::set<u32> finishedPipelines;
+    struct ScheduledNode {
+        u32 this_ptr;
+        u32 update_func;
+        bool pure;
+        const NativeClass* native;
+    };
+
+    void RunNative(const ScheduledNode& node);
+    void CompareNative(const ScheduledNode& node);
+
+    std::vector<ScheduledNode> schedule;
+    std::unique_ptr<GraphExecutor> executor;
 };
 
 } // namespace m8
@@ -1,8 +1,9 @@
 #include "m8emu.h"
-#include "kk_ihex_read.h"
-#include <fstream>
+#include <sys/stat.h>
 #include <ext/log.h>
+#include <ext/ir.h>
 #include "config.h"
+#include "dsp.h"
 
 #define HEX_ENTRY    0x60001004
 #define IRQ_HANDLER  0xFFFFFFF0
@@ -17,10 +18,19 @@
 #define FLASH_SIZE   (16 * 1024 * 1024)
 #define USB_BASE     0x402E0000
 #define USB_SIZE     0x00004000
+#define SCS_BASE     0xE000E000
+#define SCS_SIZE     0x00001000
+
+#define CPU_FREQUENCY_MHZ 600
 
 #define SYSTICK_IRQ  15
 #define USB_IRQ      (113 + 16)
 
+#define DEFAULT_TICKS_PER_RUN 10000
+#define IDLE_TIMEOUT 1ms // upper bound, pending interrupts wake the core earlier
+#define BOOT_POLLS_PER_TICK 64 // SysTick reads before boot moves virtual time forward by one tick
+#define ARM_BRANCH_SELF 0xEAFFFFFE // b .
+
 #define JIT_POOL_SIZE 6
 #define JIT_MEM_SIZE (8 * 1024)
 #define AUDIO_MEM_SIZE (256 * 1024)
@@ -29,6 +39,9 @@
 #define EXTRA_MEM_SIZE ((JIT_POOL_SIZE + 1) * JIT_MEM_SIZE + AUDIO_MEM_SIZE)
 #define AUDIO_MEM_BASE EXTRA_MEM_BASE
 #define JIT_MEM_BASE (AUDIO_MEM_BASE + AUDIO_MEM_SIZE)
+#define SCRATCH_MEM_BASE (JIT_MEM_BASE + JIT_POOL_SIZE * JIT_MEM_SIZE) // the spare JIT_MEM slot, one word per JIT
+#define ORIGINAL_STACK_TOP (SCRATCH_MEM_BASE + JIT_MEM_SIZE) // above the scratch words
+#define THUMB_BX_LR 0x4770
 
 using namespace std::chrono_literals;
 
@@ -47,13 +60,24 @@ const std::map<u32, u32> constValues = {
     {0x402C0030, 3},          // SDHC_IRQSTAT_CC | SDHC_IRQSTAT_TC
 };
 
-M8Emulator::M8Emulator() :
-    itcm(ITCM_BASE, ITCM_SIZE),
-    dtcm(DTCM_BASE, DTCM_SIZE),
-    ocram2(OCRAM2_BASE, OCRAM2_SIZE),
-    flash(FLASH_BASE, FLASH_SIZE),
-    extraMemory(EXTRA_MEM_BASE, EXTRA_MEM_SIZE),
-    usb(callbacks, USB_BASE, USB_SIZE),
+static void HaltCurrentJit(u64)
+{
+    if (auto jit = CoreCallbacks::CurrentJit()) {
+        jit->HaltExecution();
+    }
+}
+
+M8Emulator::M8Emulator(const FirmwareConfig& firmwareConfig, Scheduler& scheduler) :
+    firmwareConfig(firmwareConfig),
+    scheduler(scheduler),
+    itcm(ITCM_BASE, ITCM_SIZE, arena.Map(ITCM_BASE, ITCM_SIZE)),
+    dtcm(DTCM_BASE, DTCM_SIZE, arena.Map(DTCM_BASE, DTCM_SIZE)),
+    ocram2(OCRAM2_BASE, OCRAM2_SIZE, arena.Map(OCRAM2_BASE, OCRAM2_SIZE)),
+    flash(FLASH_BASE, FLASH_SIZE, arena.Map(FLASH_BASE, FLASH_SIZE), true),
+    extraMemory(EXTRA_MEM_BASE, EXTRA_MEM_SIZE, arena.Map(EXTRA_MEM_BASE, EXTRA_MEM_SIZE)),
+    usb(callbacks, scheduler, USB_BASE, USB_SIZE),
+    nvic(SCS_BASE, SCS_SIZE),
+    systick(scheduler),
     monitor(1)
 {
     callbacks.BindDevice(&itcm);
@@ -62,82 +86,119 @@ M8Emulator::M8Emulator() :
     callbacks.BindDevice(&flash);
     callbacks.BindDevice(&extraMemory);
     callbacks.BindDevice(&usb);
+    callbacks.BindDevice(&nvic);
     usb.BindInterrupt(USB_IRQ, [this](int irq) { TriggerInterrupt(irq); });
 
     config.page_table = &callbacks.PageTable();
+    config.fastmem_pointer = reinterpret_cast<uintptr_t>(arena.Base());
     config.callbacks = &callbacks;
     config.global_monitor = &monitor;
     // config.optimizations = Dynarmic::no_optimizations;
     cpu = std::make_shared<Dynarmic::A32::Jit>(config);
     cpu->SetCpsr(0x00000030); // Thumb mode
+    idle.SetMainJit(cpu.get());
+    callbacks.AddGlobalTranslationHook([this](bool is_thumb, u32 pc, Dynarmic::A32::IREmitter& ir) {
+        idle.Translate(is_thumb, pc, ir);
+    });
 
-    auto constValuesHook = [](u32 addr) {
-        return constValues.find(addr)->second;
-    };
     for (const auto& [addr, v] : constValues) {
-        callbacks.AddReadHook(addr, constValuesHook);
+        callbacks.AddReadHook(addr, [value = v](u32) { return value; });
     }
-    /* trick to exit interrupt */
-    callbacks.AddReadHook(IRQ_HANDLER, [this](u32) { return 0x70477047; }); // bx lr
-    callbacks.AddReadHook(0xE000E018, [this](u32) { return systick_millis_count; });
+    /* trick to exit interrupt: returning here interworks to ARM state, park on a self branch and halt the run */
+    callbacks.AddReadHook(IRQ_HANDLER, [this](u32) { return ARM_BRANCH_SELF; });
+    callbacks.AddTranslationHook(IRQ_HANDLER, [](u32, Dynarmic::A32::IREmitter& ir) {
+        ext::CallHostFunction(ir, HaltCurrentJit, 0);
+    });
+    callbacks.SetTicksPerRun(DEFAULT_TICKS_PER_RUN);
+    callbacks.AddReadHook(0xE000E018, [this](u32) {
+        /* delay()/millis() busy-waits during boot: deliver the next tick now instead of waiting for the timer */
+        if (fastBoot && !booted.load(std::memory_order_relaxed) && ++bootPolls >= BOOT_POLLS_PER_TICK) {
+            AdvanceBootTick();
+        }
+        return systick_millis_count;
+    });
     callbacks.AddReadHook(0x400D4038, [this](u32) { return SNVS_LPCR; });
     callbacks.AddWriteHook(0x400D4038, [this](u32, u32 value) { SNVS_LPCR = value; });
     callbacks.AddWriteHook(0xE000ED08, [this](u32, u32 value) { UpdateVectorTables(value); });
     /* systick timer */
-    callbacks.AddWriteHook(0xE000E010, [this](u32, u32 value) {
-        if (value & 1) {
-            systick.SetInterval(1ms, [this] (Timer&) { TriggerInterrupt(SYSTICK_IRQ); });
-            systick.Start();
-        } else {
-            systick.Stop();
-        }
-    });
+    callbacks.AddWriteHook(0xE000E010, [this](u32, u32 value) { WriteSysTickControl(value); });
 
     jitPool.resize(JIT_POOL_SIZE);
     for (int i = 0; i < jitPool.size(); i++) {
         jitPool[i] = std::make_shared<Dynarmic::A32::Jit>(config);
         jitPoolRunning[jitPool[i]] = false;
         jitPoolIndex[jitPool[i]] = i;
+        scratchAddresses[jitPool[i].get()] = SCRATCH_MEM_BASE + (i + 1) * sizeof(u32);
     }
+    scratchAddresses[cpu.get()] = SCRATCH_MEM_BASE;
+    originalJit = std::make_shared<Dynarmic::A32::Jit>(config);
 
-    auto setupDoneEntry = FirmwareConfig::GlobalConfig().GetSymbolAddress("setup_done");
-    callbacks.AddTranslationHook(setupDoneEntry, [this, setupDoneEntry](u32, Dynarmic::A32::IREmitter& ir) {
-        std::call_once(initializeFlag, [this, setupDoneEntry]() {
-            for (auto& callback : initializeCallbacks) {
-                callback();
-            }
-            ext::LogInfo("M8: setup initialized");
-        });
+    auto setupDoneEntry = firmwareConfig.GetSymbolAddress("setup_done");
+    callbacks.AddTranslationHook(setupDoneEntry, [this](u32, Dynarmic::A32::IREmitter& ir) {
+        if (!booted.load(std::memory_order_relaxed)) {
+            bootDuration = std::chrono::steady_clock::now() - bootStart;
+            ext::LogInfo("M8: setup reached in %.1f ms, %llu instructions, %llu fast-forwarded ticks",
+                std::chrono::duration<double, std::milli>(bootDuration).count(), (unsigned long long)callbacks.Cycles(), (unsigned long long)bootTicks);
+        }
+        RunInitializeCallbacks();
     });
 }
 
-std::function<void(u32, void*, int)> memoryWriteCallback;
+void M8Emulator::RunInitializeCallbacks()
+{
+    std::call_once(initializeFlag, [this]() {
+        booted.store(true, std::memory_order_relaxed);
+        if (hostFunctions) {
+            RegisterDSPFunctions(hle);
+        }
+        for (auto& callback : initializeCallbacks) {
+            callback();
+        }
+        ext::LogInfo("M8: setup initialized");
+    });
+}
 
-extern "C" ihex_bool_t ihex_data_read(struct ihex_state *ihex, ihex_record_type_t type, ihex_bool_t error)
+void M8Emulator::WriteSysTickControl(u32 value)
 {
-    error = error || (ihex->length < ihex->line_length);
-    if (type == IHEX_DATA_RECORD && !error) {
-	    auto addr = IHEX_LINEAR_ADDRESS(ihex);
-        memoryWriteCallback(addr, ihex->data, ihex->length);
+    systickControl = value;
+    if (value & 1) {
+        systick.SetInterval(1ms, [this] (Timer&) { TriggerInterrupt(SYSTICK_IRQ); });
+        systick.Start();
+    } else {
+        systick.Stop();
     }
-    return !error;
 }
 
 #define CURRENT_PC() cpu->Regs()[15]
 
+std::shared_ptr<SharedFlash> M8Emulator::LoadFlash(const std::string& hex_path, const FirmwareConfig& firmwareConfig)
+{
+    auto image = std::make_shared<SharedFlash>(FLASH_BASE, FLASH_SIZE);
+    if (!image->Load(hex_path, firmwareConfig.GetMD5Sum())) {
+        return nullptr;
+    }
+    return image;
+}
+
 void M8Emulator::LoadHEX(const char* hex_path)
 {
-    memoryWriteCallback = [this] (u32 addr, void* data, int length) {
-        callbacks.MemoryWrite(addr, data, length);
-    };
-    struct ihex_state ihex;
-    ihex_begin_read(&ihex);
-    std::ifstream infile(hex_path);
-    std::string line;
-	while (std::getline(infile, line)) {
-		ihex_read_bytes(&ihex, line.c_str(), line.size());
-	}
-    ihex_end_read(&ihex);
+    auto image = LoadFlash(hex_path, firmwareConfig);
+    if (!image) {
+        std::terminate();
+    }
+    LoadFirmware(*image);
+}
+
+void M8Emulator::LoadFirmware(const SharedFlash& image)
+{
+    bootStart = std::chrono::steady_clock::now();
+    firmwarePath = image.Path();
+    arena.MapShared(FLASH_BASE, FLASH_SIZE, image.Fd());
+    for (const auto& segment : image.Segments()) {
+        if (callbacks.MemoryWrite(segment.addr, (void*)segment.data, segment.size) != (int)segment.size) {
+            ext::LogError("M8: HEX segment 0x%x (size 0x%x) runs into unmapped memory", segment.addr, segment.size);
+        }
+    }
 
     u32 entry = callbacks.MemoryRead32(HEX_ENTRY);
     CURRENT_PC() = entry;
@@ -145,62 +206,239 @@ void M8Emulator::LoadHEX(const char* hex_path)
 
 void M8Emulator::UpdateVectorTables(u32 addr)
 {
+    vectorTableAddress = addr;
     vectorTables = (u32*)callbacks.MemoryMap(addr);
     ext::LogInfo("NVIC: UpdateVectorTables 0x%x", addr);
 }
 
 void M8Emulator::TriggerInterrupt(int interrupt)
 {
-    std::lock_guard lock(interruptMutex);
-    pendingInterrupts[interrupt] = true;
+    nvic.SetPending(interrupt);
+    {
+        std::lock_guard lock(idleMutex);
+    }
+    idleWakeup.notify_one();
+    if (nvic.Priority(interrupt) < activePriority.load(std::memory_order_relaxed)) {
+        /* end the current run slice early so the interrupt is taken at the next Run() */
+        cpu->HaltExecution();
+    }
 }
 
 void M8Emulator::EnterInterrupt(int interrupt)
 {
-    inInterrupt = true;
-    inInterruptNumber = interrupt;
-    backupRegs = {cpu->Regs(), cpu->Cpsr(), cpu->Fpscr()};
+    int priority = nvic.Priority(interrupt);
+    exceptionFrames.push_back({cpu->Regs(), cpu->Cpsr(), cpu->Fpscr(), interrupt, priority});
+    activePriority.store(priority, std::memory_order_relaxed);
     CURRENT_PC() = vectorTables[interrupt] & (~1);
     cpu->SetCpsr(0x00000030); // Thumb mode
     cpu->SetFpscr(0);
     cpu->Regs()[14] = IRQ_HANDLER; // LR
-    ext::LogDebug("EnterInterrupt: irq = %d, pc = 0x%x", interrupt, CURRENT_PC());
+    ext::LogDebug("EnterInterrupt: irq = %d, priority = %d, depth = %d, pc = 0x%x", interrupt, priority, (int)exceptionFrames.size(), CURRENT_PC());
 }
 
 void M8Emulator::ExitInterrupt()
 {
-    const auto& [regs, cpsr, fpscr] = backupRegs;
-	cpu->Regs() = regs;
-	cpu->SetCpsr(cpsr);
-	cpu->SetFpscr(fpscr);
-    inInterrupt = false;
+    const auto& frame = exceptionFrames.back();
+    cpu->Regs() = frame.regs;
+    cpu->SetCpsr(frame.cpsr);
+    cpu->SetFpscr(frame.fpscr);
+    exceptionFrames.pop_back();
+    activePriority.store(exceptionFrames.empty() ? NVIC::THREAD_PRIORITY : exceptionFrames.back().priority, std::memory_order_relaxed);
     ext::LogDebug("ExitInterrupt: pc = 0x%x", CURRENT_PC());
 }
 
+void M8Emulator::AdvanceBootTick()
+{
+    bootPolls = 0;
+    if (!nvic.IsPending(SYSTICK_IRQ)) {
+        bootTicks++;
+        TriggerInterrupt(SYSTICK_IRQ);
+    }
+}
+
+void M8Emulator::WaitForInterrupt()
+{
+    /* emulated clocks only move while the core runs, keep spinning for them */
+    if (!scheduler.Threaded()) {
+        return;
+    }
+    std::unique_lock lock(idleMutex);
+    idleWakeup.wait_for(lock, IDLE_TIMEOUT, [this]() { return nvic.HasPending(); });
+}
+
+u64 M8Emulator::EmulatedMicros() const
+{
+    return callbacks.Cycles() / CPU_FREQUENCY_MHZ;
+}
+
 u32 M8Emulator::Run()
 {
-    if (inInterrupt) {
-        if (CURRENT_PC() == 0 || CURRENT_PC() >= IRQ_HANDLER) {
-            ExitInterrupt();
-        }
-    } else {
-        std::lock_guard lock(interruptMutex);
-        for (auto [interrupt, triggered] : pendingInterrupts) {
-            if (triggered) {
-                EnterInterrupt(interrupt);
-                pendingInterrupts[interrupt] = false;
-                break;
-            }
-        }
+    scheduler.Poll();
+    if (!snapshotPath.empty() && booted.load(std::memory_order_relaxed) && exceptionFrames.empty()) {
+        SaveSnapshot(snapshotPath);
+        snapshotPath.clear();
+    }
+    if (!exceptionFrames.empty() && (CURRENT_PC() == 0 || CURRENT_PC() >= IRQ_HANDLER)) {
+        ExitInterrupt();
+    }
+    int interrupt = nvic.AcknowledgePending(activePriority.load(std::memory_order_relaxed));
+    if (interrupt >= 0) {
+        EnterInterrupt(interrupt);
+        nvic.ReportEntryLatency();
     }
 
     callbacks.lock();
+    CoreCallbacks::SetCurrentJit(cpu.get());
     cpu->Run();
     callbacks.unlock();
 
+    if (idle.EndRun()) {
+        if (fastBoot && !booted.load(std::memory_order_relaxed)) {
+            AdvanceBootTick();
+        } else {
+            WaitForInterrupt();
+        }
+    }
+
     return CURRENT_PC();
 }
 
+/* size and modification time of the firmware file, a snapshot only restores onto the image it was taken from */
+static u64 FirmwareStamp(const std::string& firmware)
+{
+    struct stat st;
+    if (stat(firmware.c_str(), &st) != 0) {
+        return 0;
+    }
+    return ((u64)st.st_size << 40) ^ ((u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+}
+
+void M8Emulator::AddSnapshotHandler(const std::string& name, std::function<void(StateWriter&)> save, std::function<StateLoader(StateReader&)> parse)
+{
+    snapshotHandlers[name] = {save, parse};
+}
+
+bool M8Emulator::SaveSnapshot(const std::string& path)
+{
+    auto now = std::chrono::steady_clock::now();
+    /* holding the core lock keeps the audio graph from touching guest memory while it is written out */
+    std::lock_guard lock(callbacks);
+    Snapshot snapshot;
+    /* flash is the shared read-only image, a restore maps it again instead */
+    for (auto* memory : {&itcm, &dtcm, &ocram2, &extraMemory}) {
+        snapshot.AddMemory(memory->BaseAddress(), (const u8*)memory->Map(0), memory->Size());
+    }
+
+    StateWriter cpuState;
+    cpuState.Write(cpu->Regs());
+    cpuState.Write(cpu->ExtRegs());
+    cpuState.Write(cpu->Cpsr());
+    cpuState.Write(cpu->Fpscr());
+    snapshot.AddSection("cpu", std::move(cpuState.data));
+
+    StateWriter emuState;
+    emuState.Write(vectorTableAddress);
+    emuState.Write(systickControl);
+    emuState.Write(systick_millis_count);
+    emuState.Write(SNVS_LPCR);
+    snapshot.AddSection("m8emu", std::move(emuState.data));
+
+    StateWriter nvicState;
+    nvic.SaveState(nvicState);
+    snapshot.AddSection("nvic", std::move(nvicState.data));
+
+    StateWriter usbState;
+    usb.SaveState(usbState);
+    snapshot.AddSection("usb", std::move(usbState.data));
+
+    for (const auto& [name, handler] : snapshotHandlers) {
+        StateWriter state;
+        std::get<0>(handler)(state);
+        snapshot.AddSection(name, std::move(state.data));
+    }
+
+    if (!snapshot.Save(path, FirmwareStamp(firmwarePath))) {
+        return false;
+    }
+    auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - now).count();
+    ext::LogInfo("M8: snapshot saved to %s in %.1f ms", path.c_str(), duration);
+    return true;
+}
+
+bool M8Emulator::LoadSnapshot(const std::string& path, const SharedFlash& image)
+{
+    auto now = std::chrono::steady_clock::now();
+    Snapshot snapshot;
+    if (!snapshot.Load(path, FirmwareStamp(image.Path()))) {
+        return false;
+    }
+    /* parse every section first, a short or corrupt one still leaves the cold boot to fall back to */
+    std::vector<std::string> names = {"cpu", "m8emu", "nvic", "usb"};
+    for (const auto& [name, handler] : snapshotHandlers) {
+        names.push_back(name);
+    }
+    for (const auto& name : names) {
+        if (!snapshot.Section(name)) {
+            ext::LogError("M8: snapshot %s has no %s section", path.c_str(), name.c_str());
+            return false;
+        }
+    }
+    StateReader cpuState(*snapshot.Section("cpu"));
+    auto regs = cpuState.Read<std::array<u32, 16>>();
+    auto extRegs = cpuState.Read<std::array<u32, 64>>();
+    u32 cpsr = cpuState.Read<u32>();
+    u32 fpscr = cpuState.Read<u32>();
+
+    StateReader emuState(*snapshot.Section("m8emu"));
+    u32 vectorTable = emuState.Read<u32>();
+    u32 control = emuState.Read<u32>();
+    u32 millis = emuState.Read<u32>();
+    u32 lpcr = emuState.Read<u32>();
+
+    StateReader nvicState(*snapshot.Section("nvic"));
+    StateReader usbState(*snapshot.Section("usb"));
+    std::vector<StateLoader> loaders = {nvic.ParseState(nvicState), usb.ParseState(usbState)};
+    for (const auto& [name, handler] : snapshotHandlers) {
+        StateReader state(*snapshot.Section(name));
+        loaders.push_back(std::get<1>(handler)(state));
+    }
+    bool ok = cpuState.Done() && emuState.Done();
+    for (const auto& loader : loaders) {
+        ok = ok && loader;
+    }
+    if (!ok) {
+        ext::LogError("M8: snapshot %s is corrupted", path.c_str());
+        return false;
+    }
+
+    /* memory is replaced in place, a failure past this point leaves nothing to fall back to */
+    if (!snapshot.MapMemory(arena)) {
+        std::terminate();
+    }
+    /* snapshots written before flash was left out carry a private copy of it */
+    arena.MapShared(FLASH_BASE, FLASH_SIZE, image.Fd());
+
+    firmwarePath = image.Path();
+    cpu->Regs() = regs;
+    cpu->ExtRegs() = extRegs;
+    cpu->SetCpsr(cpsr);
+    cpu->SetFpscr(fpscr);
+    systick_millis_count = millis;
+    SNVS_LPCR = lpcr;
+    if (vectorTable) {
+        UpdateVectorTables(vectorTable);
+    }
+    WriteSysTickControl(control);
+    for (const auto& loader : loaders) {
+        loader();
+    }
+
+    bootDuration = std::chrono::steady_clock::now() - now;
+    ext::LogInfo("M8: snapshot restored from %s in %.1f ms", path.c_str(), std::chrono::duration<double, std::milli>(bootDuration).count());
+    RunInitializeCallbacks();
+    return true;
+}
+
 std::shared_ptr<Dynarmic::A32::Jit> M8Emulator::GetIdleJit()
 {
     std::unique_lock lock(jitPoolMutex);
@@ -229,10 +467,104 @@ void M8Emulator::SetJitIdle(const std::shared_ptr<Dynarmic::A32::Jit>& jit)
     jitPoolIdle.notify_one();
 }
 
+void M8Emulator::CallReplacedFunction(u64 ptr, u64 args01, u64 args23)
+{
+    auto* replaced = (ReplacedFunction*)ptr;
+    replaced->emu->WriteScratch(replaced->function(args01, args01 >> 32, args23, args23 >> 32));
+}
+
+u32 M8Emulator::ScratchAddress(Dynarmic::A32::Jit* jit)
+{
+    auto iter = scratchAddresses.find(jit);
+    return iter != scratchAddresses.end() ? iter->second : SCRATCH_MEM_BASE;
+}
+
+void M8Emulator::WriteScratch(u32 value)
+{
+    callbacks.MemoryWrite32(ScratchAddress(CoreCallbacks::CurrentJit()), value);
+}
+
+/* SP of the caller, stored in the scratch word on entry of a replaced function */
+u32 M8Emulator::StackPointer()
+{
+    return callbacks.MemoryRead32(ScratchAddress(CoreCallbacks::CurrentJit()));
+}
+
+/* runs the firmware's own code of a replaced function on a dedicated JIT, nested in the calling one */
+u32 M8Emulator::CallOriginal(u32 addr, const std::array<u32, 4>& regs, const std::vector<u32>& stack)
+{
+    std::lock_guard lock(originalMutex);
+    auto* caller = CoreCallbacks::CurrentJit();
+    CoreCallbacks::SetCurrentJit(originalJit.get());
+    originalJit->SetCpsr(0x00000030); // Thumb mode
+    originalJit->SetFpscr(0);
+    for (int i = 0; i < regs.size(); i++) {
+        originalJit->Regs()[i] = regs[i];
+    }
+    u32 sp = ORIGINAL_STACK_TOP - stack.size() * sizeof(u32);
+    for (int i = 0; i < stack.size(); i++) {
+        callbacks.MemoryWrite32(sp + i * sizeof(u32), stack[i]);
+    }
+    originalJit->Regs()[13] = sp;
+    originalJit->Regs()[14] = IRQ_HANDLER;
+    originalJit->Regs()[15] = addr & (~1);
+    while (originalJit->Regs()[15] != 0 && originalJit->Regs()[15] < IRQ_HANDLER) {
+        originalJit->Run();
+    }
+    u32 result = originalJit->Regs()[0];
+    CoreCallbacks::SetCurrentJit(caller);
+    return result;
+}
+
+/*
+ * The entry fetches as "bx lr", and the block translated for it first calls
+ * the host function, which leaves its result in the scratch word of the
+ * running JIT for R0. Blocks compiled from the original code are dropped.
+ * originalJit still sees the firmware code, for CallOriginal().
+ */
+void M8Emulator::ReplaceFunction(u32 addr, HostFunction function)
+{
+    addr &= ~1;
+    auto& replaced = replacedFunctions[addr];
+    replaced = std::make_unique<ReplacedFunction>(ReplacedFunction{this, std::move(function)});
+
+    u32 word = addr & ~3;
+    callbacks.AddReadHook(word, [this, word](u32) {
+        u32 value = *(u32*)callbacks.MemoryMap(word);
+        if (CoreCallbacks::CurrentJit() == originalJit.get()) {
+            return value;
+        }
+        for (u32 half = 0; half < 2; half++) {
+            if (replacedFunctions.count(word + half * 2)) {
+                value = (value & ~(0xFFFFu << (half * 16))) | (THUMB_BX_LR << (half * 16));
+            }
+        }
+        return value;
+    });
+    callbacks.AddTranslationHook(addr, [this, context = replaced.get()](u32, Dynarmic::A32::IREmitter& ir) {
+        auto* jit = CoreCallbacks::CurrentJit();
+        if (jit == originalJit.get()) {
+            return;
+        }
+        u32 scratch = ScratchAddress(jit);
+        ext::StoreRegister(ir, ext::Reg::SP, scratch);
+        ext::U64 args01(ir, ext::Reg::R0, ext::Reg::R1);
+        ext::U64 args23(ir, ext::Reg::R2, ext::Reg::R3);
+        ext::CallHostFunction(ir, CallReplacedFunction, (u64)context, args01, args23);
+        ext::LoadRegister(ir, ext::Reg::R0, scratch);
+    });
+    cpu->InvalidateCacheRange(word, sizeof(u32));
+    for (auto& jit : jitPool) {
+        jit->InvalidateCacheRange(word, sizeof(u32));
+    }
+}
+
 u32 M8Emulator::CallFunction1(u32 addr, u32 param1)
 {
     auto now = std::chrono::steady_clock::now();
+    auto cycles = CoreCallbacks::ThreadCycles();
     auto jit = GetIdleJit();
+    CoreCallbacks::SetCurrentJit(jit.get());
     jit->SetCpsr(0x00000030); // Thumb mode
     jit->SetFpscr(0);
     jit->Regs()[15] = addr & (~1);
@@ -248,7 +580,8 @@ u32 M8Emulator::CallFunction1(u32 addr, u32 param1)
     u32 result = jit->Regs()[0];
     SetJitIdle(jit);
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
-    ext::LogDebug("call function 0x%x result = 0x%x, duration = %d us", addr, result, duration);
+    cycles = CoreCallbacks::ThreadCycles() - cycles;
+    ext::LogDebug("call function 0x%x result = 0x%x, duration = %d us, %llu instructions", addr, result, duration, (unsigned long long)cycles);
 
     return result;
 }
@@ -1,9 +1,16 @@
 #pragma once
 
+#include "arena.h"
 #include "emu.h"
 #include "io.h"
 #include "timer.h"
 #include "usb.h"
+#include "nvic.h"
+#include "idle.h"
+#include "snapshot.h"
+#include "loader.h"
+#include "config.h"
+#include "hle.h"
 #include "dynarmic/interface/A32/config.h"
 #include "dynarmic/interface/exclusive_monitor.h"
 #include <memory>
@@ -11,59 +18,125 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 
 namespace m8 {
 
+struct ExceptionFrame {
+    std::array<u32, 16> regs;
+    u32 cpsr;
+    u32 fpscr;
+    int exception;
+    int priority;
+};
+
 class M8Emulator {
 public:
-    M8Emulator();
+    /* host implementation of a firmware function: R0-R3 in, R0 out */
+    using HostFunction = std::function<u32(u32, u32, u32, u32)>;
+
+    explicit M8Emulator(const FirmwareConfig& firmwareConfig, Scheduler& scheduler = Scheduler::Default());
+    static std::shared_ptr<SharedFlash> LoadFlash(const std::string& hex_path, const FirmwareConfig& firmwareConfig);
     void LoadHEX(const char* hex_path);
+    void LoadFirmware(const SharedFlash& image);
+    bool LoadSnapshot(const std::string& path, const SharedFlash& image);
+    bool SaveSnapshot(const std::string& path);
+    void SaveSnapshotAfterBoot(const std::string& path) { snapshotPath = path; }
+    void AddSnapshotHandler(const std::string& name, std::function<void(StateWriter&)> save, std::function<StateLoader(StateReader&)> parse);
     u32 Run();
+    void SetRunSlice(u64 ticks) { callbacks.SetTicksPerRun(ticks); }
+    u64 RunSlice() const { return callbacks.TicksPerRun(); }
+    void SetIdleDetection(bool enabled) { idle.SetEnabled(enabled); }
+    void SetBootFastForward(bool enabled) { fastBoot = enabled; }
+    void SetHostFunctions(bool enabled) { hostFunctions = enabled; }
+    bool Booted() const { return booted.load(std::memory_order_relaxed); }
+    std::chrono::steady_clock::duration BootDuration() const { return bootDuration; }
 
     CoreCallbacks& Callbacks() { return callbacks; }
     u32 CallFunction1(u32 addr, u32 param1);
+    void ReplaceFunction(u32 addr, HostFunction function);
+    void WriteScratch(u32 value);
+    u32 StackPointer();
+    u32 CallOriginal(u32 addr, const std::array<u32, 4>& regs, const std::vector<u32>& stack);
+    HLERegistry& HLE() { return hle; }
 
     void AttachInitializeCallback(std::function<void()> callback) { initializeCallbacks.push_back(callback); }
 
     m8::USBDevice& USBDevice() { return usb; }
+    const FirmwareConfig& Config() const { return firmwareConfig; }
+    int JitPoolSize() const { return jitPool.size(); }
+    Scheduler& TimerScheduler() { return scheduler; }
+    u64 EmulatedMicros() const;
+    const Histogram* InterruptLatency(int interrupt) { return nvic.EntryLatency(interrupt); }
 
 private:
     void UpdateVectorTables(u32 addr);
+    void WriteSysTickControl(u32 value);
+    void RunInitializeCallbacks();
     void TriggerInterrupt(int interrupt);
     void EnterInterrupt(int interrupt);
     void ExitInterrupt();
+    void WaitForInterrupt();
+    void AdvanceBootTick();
     std::shared_ptr<Dynarmic::A32::Jit> GetIdleJit();
     void SetJitIdle(const std::shared_ptr<Dynarmic::A32::Jit>& jit);
+    u32 ScratchAddress(Dynarmic::A32::Jit* jit);
+    static void CallReplacedFunction(u64 ptr, u64 args01, u64 args23);
 
 private:
+    const FirmwareConfig& firmwareConfig;
+    Scheduler& scheduler;
+    MemoryArena arena;
     MemoryDevice itcm;
     MemoryDevice dtcm;
     MemoryDevice ocram2;
     MemoryDevice flash;
     MemoryDevice extraMemory;
     USB usb;
+    NVIC nvic;
     u32 systick_millis_count = 0;
     u32 SNVS_LPCR = 0;
+    u32 vectorTableAddress = 0;
     u32* vectorTables = nullptr;
-    bool inInterrupt = false;
-    int inInterruptNumber = 0;
-    std::tuple<std::array<std::uint32_t, 16>, uint32_t, uint32_t> backupRegs;
-    std::map<int, bool> pendingInterrupts;
-    std::mutex interruptMutex;
+    u32 systickControl = 0;
+    std::vector<ExceptionFrame> exceptionFrames;
+    std::atomic<int> activePriority{NVIC::THREAD_PRIORITY};
     Timer systick;
+    bool fastBoot = true;
+    bool hostFunctions = true;
+    std::atomic<bool> booted{false};
+    u32 bootPolls = 0;
+    u64 bootTicks = 0;
+    std::chrono::steady_clock::time_point bootStart;
+    std::chrono::steady_clock::duration bootDuration{};
+    std::mutex idleMutex;
+    std::condition_variable idleWakeup;
     std::mutex jitPoolMutex;
     std::condition_variable jitPoolIdle;
     std::vector<std::shared_ptr<Dynarmic::A32::Jit>> jitPool;
     std::map<std::shared_ptr<Dynarmic::A32::Jit>, bool> jitPoolRunning;
     std::map<std::shared_ptr<Dynarmic::A32::Jit>, int> jitPoolIndex;
+    std::map<Dynarmic::A32::Jit*, u32> scratchAddresses;
+    struct ReplacedFunction {
+        M8Emulator* emu;
+        HostFunction function;
+    };
+    std::map<u32, std::unique_ptr<ReplacedFunction>> replacedFunctions;
+    std::shared_ptr<Dynarmic::A32::Jit> originalJit; // runs replaced functions as the firmware has them
+    std::mutex originalMutex;
     std::vector<std::function<void()>> initializeCallbacks;
     std::once_flag initializeFlag;
+    std::string firmwarePath;
+    std::string snapshotPath;
+    std::map<std::string, std::tuple<std::function<void(StateWriter&)>, std::function<StateLoader(StateReader&)>>> snapshotHandlers;
 
 private:
     CoreCallbacks callbacks;
+    IdleDetector idle{callbacks};
     std::shared_ptr<Dynarmic::A32::Jit> cpu;
     Dynarmic::A32::UserConfig config;
     Dynarmic::ExclusiveMonitor monitor;
+    HLERegistry hle{*this};
 };
 
 } // namespace m8
@@ -1,19 +1,278 @@
 #include "m8emu.h"
 #include "m8audio.h"
 #include "usbipd.h"
+#include "render.h"
 #include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <algorithm>
+#include <memory>
+#include <random>
 #include "config.h"
+#include <ext/log.h>
+
+#define GRAPH_BENCHMARK_NODES  200
+#define GRAPH_BENCHMARK_INPUTS 2     // edges into every node but the first
+#define GRAPH_BENCHMARK_CYCLES 10000
 
 using namespace m8;
 
+struct Instance {
+    std::unique_ptr<M8Emulator> emu;
+    std::unique_ptr<USBIPServer> server;
+    std::unique_ptr<M8AudioProcessor> audio;
+    std::thread thread;
+};
+
+static void Usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [--run-slice ticks] [--no-idle] [--no-fast-boot] [--boot-benchmark] [--audio-benchmark] [--graph-benchmark] [--snapshot file] [--instances n] [--audio-workers n] [--no-silence-skip] [--native-audio on|off|compare] [--audio-latency ms] [--audio-stats seconds] [--render out.wav|out.raw] [--duration seconds] [--batch jobs.txt] [--jobs n] [--no-hle] [--hle-verify symbol|all] firmware.hex\n", name);
+}
+
+/* one line per instance, counters since Setup() */
+static void LogAudioStats(int index, M8AudioProcessor& audio)
+{
+    if (!audio.ProcessDuration().Count()) {
+        return;
+    }
+    auto stats = audio.GetStats();
+    ext::LogInfo("M8: instance %d audio: %llu cycles, process mean/p99/max %llu/%llu/%llu us, %llu deadline misses, %llu missed ticks",
+        index, (unsigned long long)stats.cycles, (unsigned long long)stats.durationMean, (unsigned long long)stats.durationP99,
+        (unsigned long long)stats.durationMax, (unsigned long long)stats.deadlineMisses, (unsigned long long)stats.missedTicks);
+    ext::LogInfo("M8: instance %d usb audio: fill min/p50/p99/max %llu/%llu/%llu/%llu of %llu bytes, %llu underruns, %llu dropped bytes, "
+        "%llu catch-up cycles, %llu headroom blocks, %llu saturations (%llu cycles without catch-up), clock x%.4f", index, (unsigned long long)stats.fillMin, (unsigned long long)stats.fillP50,
+        (unsigned long long)audio.StreamFill().Percentile(99), (unsigned long long)stats.fillMax, (unsigned long long)stats.fillCapacity,
+        (unsigned long long)stats.underruns, (unsigned long long)stats.droppedBytes, (unsigned long long)stats.catchUpCycles,
+        (unsigned long long)stats.headroomBlocks, (unsigned long long)stats.saturations, (unsigned long long)stats.backedOffCycles, stats.clockRatio);
+}
+
+/* scheduling cost of the graph executor alone: a fixed random DAG of empty nodes, no firmware needed */
+static void RunGraphBenchmark(int workers)
+{
+    std::mt19937 random(1);
+    std::vector<std::tuple<int, int>> edges;
+    for (int to = 1; to < GRAPH_BENCHMARK_NODES; to++) {
+        for (int i = 0; i < GRAPH_BENCHMARK_INPUTS; i++) {
+            edges.emplace_back(random() % to, to);
+        }
+    }
+    GraphExecutor executor(std::max(1, workers), [](int) {});
+    executor.Compile(GRAPH_BENCHMARK_NODES, edges);
+    for (int i = 0; i < GRAPH_BENCHMARK_CYCLES / 10; i++) {
+        executor.Run();
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < GRAPH_BENCHMARK_CYCLES; i++) {
+        executor.Run();
+    }
+    auto duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("graph benchmark: %d nodes, %d edges on %d workers, %.1f us per cycle\n", GRAPH_BENCHMARK_NODES, (int)edges.size(),
+        executor.Workers(), duration / GRAPH_BENCHMARK_CYCLES);
+}
+
 int main(int argc, char* argv[]) {
-    auto firmware = argv[1];
-    if (!FirmwareConfig::GlobalConfig().LoadConfig({}, firmware)) {
+    u64 runSlice = 0;
+    bool idleDetection = true;
+    bool fastBoot = true;
+    bool bootBenchmark = false;
+    bool audioBenchmark = false;
+    bool graphBenchmark = false;
+    std::string snapshot;
+    int numInstances = 1;
+    int audioWorkers = M8AudioProcessor::DEFAULT_WORKERS;
+    bool silenceElision = true;
+    auto nativeMode = M8AudioProcessor::NativeMode::On;
+    double audioLatency = 0;
+    double audioStats = 0;
+    bool hostFunctions = true;
+    std::vector<std::string> hleVerify;
+    std::string renderPath;
+    double renderDuration = 60;
+    std::string batchPath;
+    int batchJobs = 0;
+    static const option options[] = {
+        {"run-slice", required_argument, nullptr, 's'},
+        {"no-idle", no_argument, nullptr, 'n'},
+        {"no-fast-boot", no_argument, nullptr, 'f'},
+        {"boot-benchmark", no_argument, nullptr, 'b'},
+        {"audio-benchmark", no_argument, nullptr, 'a'},
+        {"graph-benchmark", no_argument, nullptr, 'g'},
+        {"snapshot", required_argument, nullptr, 'S'},
+        {"instances", required_argument, nullptr, 'i'},
+        {"audio-workers", required_argument, nullptr, 'w'},
+        {"no-silence-skip", no_argument, nullptr, 'e'},
+        {"native-audio", required_argument, nullptr, 'N'},
+        {"audio-latency", required_argument, nullptr, 'l'},
+        {"audio-stats", required_argument, nullptr, 't'},
+        {"no-hle", no_argument, nullptr, 'H'},
+        {"hle-verify", required_argument, nullptr, 'v'},
+        {"render", required_argument, nullptr, 'r'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"batch", required_argument, nullptr, 'B'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:nfbagS:i:w:eN:l:t:Hv:r:d:B:j:", options, nullptr)) != -1) {
+        switch (opt) {
+        case 's':
+            runSlice = strtoull(optarg, nullptr, 0);
+            break;
+        case 'n':
+            idleDetection = false;
+            break;
+        case 'f':
+            fastBoot = false;
+            break;
+        case 'b':
+            bootBenchmark = true;
+            break;
+        case 'a':
+            audioBenchmark = true;
+            break;
+        case 'g':
+            graphBenchmark = true;
+            break;
+        case 'S':
+            snapshot = optarg;
+            break;
+        case 'i':
+            numInstances = std::max(1, atoi(optarg));
+            break;
+        case 'w':
+            audioWorkers = atoi(optarg);
+            break;
+        case 'e':
+            silenceElision = false;
+            break;
+        case 'N':
+            if (!strcmp(optarg, "off")) {
+                nativeMode = M8AudioProcessor::NativeMode::Off;
+            } else if (!strcmp(optarg, "compare")) {
+                nativeMode = M8AudioProcessor::NativeMode::Compare;
+            } else if (!strcmp(optarg, "on")) {
+                nativeMode = M8AudioProcessor::NativeMode::On;
+            } else {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            audioLatency = atof(optarg);
+            break;
+        case 't':
+            audioStats = atof(optarg);
+            break;
+        case 'H':
+            hostFunctions = false;
+            break;
+        case 'v':
+            hleVerify.push_back(optarg);
+            break;
+        case 'r':
+            renderPath = optarg;
+            break;
+        case 'd':
+            renderDuration = atof(optarg);
+            break;
+        case 'B':
+            batchPath = optarg;
+            break;
+        case 'j':
+            batchJobs = atoi(optarg);
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (graphBenchmark) {
+        RunGraphBenchmark(audioWorkers);
+        return 0;
+    }
+    if (optind >= argc) {
+        Usage(argv[0]);
         return 1;
     }
 
-    M8Emulator m8emu;
-    m8emu.LoadHEX(firmware);
+    auto firmware = argv[optind];
+    FirmwareConfig config;
+    if (!config.LoadConfig({}, firmware)) {
+        return 1;
+    }
+    /* parsed once, every instance maps the same read-only flash */
+    auto flash = M8Emulator::LoadFlash(firmware, config);
+    if (!flash) {
+        return 1;
+    }
+
+    auto createEmulator = [&](Scheduler& scheduler) {
+        auto emu = std::make_unique<M8Emulator>(config, scheduler);
+        if (runSlice) {
+            emu->SetRunSlice(runSlice);
+        }
+        emu->SetIdleDetection(idleDetection);
+        emu->SetBootFastForward(fastBoot);
+        emu->SetHostFunctions(hostFunctions);
+        for (const auto& symbol : hleVerify) {
+            emu->HLE().SetVerify(symbol, true);
+        }
+        return emu;
+    };
+    /* restore the post-boot snapshot when it matches the firmware, otherwise boot and write it once setup is done */
+    auto boot = [&](M8Emulator& emu, bool writeSnapshot) {
+        if (snapshot.empty() || !emu.LoadSnapshot(snapshot, *flash)) {
+            emu.LoadFirmware(*flash);
+            if (!snapshot.empty() && writeSnapshot) {
+                emu.SaveSnapshotAfterBoot(snapshot);
+            }
+        }
+    };
+
+    if (bootBenchmark) {
+        auto emu = createEmulator(Scheduler::Default());
+        boot(*emu, false);
+        while (!emu->Booted()) {
+            emu->Run();
+        }
+        printf("boot: %.1f ms\n", std::chrono::duration<double, std::milli>(emu->BootDuration()).count());
+        emu->HLE().Report();
+        return 0;
+    }
+
+    /* offline: one render, a batch or the audio benchmark, forked from a single boot */
+    if (!renderPath.empty() || !batchPath.empty() || audioBenchmark) {
+        std::vector<RenderJob> jobs;
+        if (!batchPath.empty() && !LoadRenderJobs(batchPath, renderDuration, jobs)) {
+            return 1;
+        }
+        Scheduler scheduler;
+        auto emu = createEmulator(scheduler);
+        scheduler.SetClock([emu = emu.get()]() { return emu->EmulatedMicros(); });
+        auto audio = std::make_unique<M8AudioProcessor>(*emu, audioWorkers);
+        audio->SetSilenceElision(silenceElision);
+        audio->SetNativeMode(nativeMode);
+        OfflineRenderer renderer(*emu, *audio);
+        emu->AttachInitializeCallback([&audio]() { audio->Setup(); });
+        boot(*emu, false);
+        while (!emu->Booted()) {
+            emu->Run();
+        }
+        if (audioBenchmark) {
+            /* single blocks per JIT run against the configured slice */
+            RunAudioBenchmark(renderer, *emu, {1, emu->RunSlice()});
+            return 0;
+        }
+        if (batchPath.empty()) {
+            return renderer.Render(renderPath, renderDuration) ? 0 : 1;
+        }
+        /* a render keeps the core and the audio workers busy */
+        int cores = std::max(1u, std::thread::hardware_concurrency());
+        int concurrency = batchJobs > 0 ? batchJobs : std::max(1, cores / std::max(1, audioWorkers));
+        return RunRenderBatch(renderer, *emu, jobs, concurrency) ? 1 : 0;
+    }
 
     auto loop = uvw::loop::get_default();
     std::thread uvloop([loop]() {
@@ -22,16 +281,40 @@ int main(int argc, char* argv[]) {
         }
     });
 
-    USBIPServer server(*loop, m8emu.USBDevice());
-    M8AudioProcessor m8audio(m8emu);
-
-    m8emu.AttachInitializeCallback([&]() {
-        m8audio.Setup();
-        server.Start();
-    });
-
-    while (true) {
-        m8emu.Run();
+    std::vector<Instance> instances(numInstances);
+    for (int i = 0; i < numInstances; i++) {
+        auto& instance = instances[i];
+        instance.emu = createEmulator(Scheduler::Default());
+        instance.server = std::make_unique<USBIPServer>(*loop, instance.emu->USBDevice(), USBIPServer::DEFAULT_PORT + i);
+        instance.audio = std::make_unique<M8AudioProcessor>(*instance.emu, audioWorkers);
+        instance.audio->SetSilenceElision(silenceElision);
+        instance.audio->SetNativeMode(nativeMode);
+        if (audioLatency > 0) {
+            instance.audio->SetTargetLatency(std::chrono::microseconds((u64)(audioLatency * 1000)));
+        }
+        instance.emu->AttachInitializeCallback([&instance]() {
+            instance.audio->Setup();
+            instance.server->Start();
+        });
+        boot(*instance.emu, i == 0);
+        ext::LogInfo("M8: instance %d on usbip port %d", i, USBIPServer::DEFAULT_PORT + i);
+    }
+    for (auto& instance : instances) {
+        instance.thread = std::thread([&instance]() {
+            while (true) {
+                instance.emu->Run();
+            }
+        });
+    }
+    /* the emulator threads never return, the main thread is free to report */
+    while (audioStats > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(audioStats));
+        for (int i = 0; i < numInstances; i++) {
+            LogAudioStats(i, *instances[i].audio);
+        }
+    }
+    for (auto& instance : instances) {
+        instance.thread.join();
     }
     return 0;
 }
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+#include <string>
+
+namespace m8 {
+
+/* RFC 1321, only used to check firmware images against firmware.yaml */
+class MD5 {
+public:
+    MD5();
+    void Update(const void* data, std::size_t length);
+    std::array<u8, 16> Final();
+
+    static std::string HexDigest(const void* data, std::size_t length);
+
+private:
+    void Transform(const u8* block);
+
+    std::array<u32, 4> state;
+    u64 length = 0;
+    std::array<u8, 64> buffer;
+};
+
+} // namespace m8
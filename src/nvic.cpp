@@ -0,0 +1,171 @@
+#include "nvic.h"
+#include <chrono>
+#include <ext/log.h>
+
+#define NVIC_IPR_BEGIN  0x400
+#define NVIC_IPR_END    0x4F0
+#define SCB_SHPR_BEGIN  0xD18
+#define SCB_SHPR_END    0xD24
+
+#define LATENCY_REPORT_INTERVAL (10ULL * 1000 * 1000 * 1000) // ns
+
+namespace m8 {
+
+static u64 NowNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+NVIC::NVIC(u32 baseAddr, u32 size) : Device(baseAddr, size)
+{
+}
+
+void NVIC::SetPending(int exception)
+{
+    u64 bit = 1ULL << (exception % 64);
+    if (!(pending[exception / 64].load(std::memory_order_relaxed) & bit)) {
+        triggerTimes[exception].store(NowNanoseconds(), std::memory_order_relaxed);
+    }
+    pending[exception / 64].fetch_or(bit, std::memory_order_release);
+}
+
+bool NVIC::IsPending(int exception) const
+{
+    return pending[exception / 64].load(std::memory_order_acquire) & (1ULL << (exception % 64));
+}
+
+bool NVIC::HasPending() const
+{
+    for (const auto& word : pending) {
+        if (word.load(std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int NVIC::AcknowledgePending(int activePriority)
+{
+    /* lowest priority value wins, ties go to the lowest exception number */
+    int best = -1;
+    int bestPriority = activePriority;
+    for (int i = 0; i < NUM_WORDS; i++) {
+        u64 bits = pending[i].load(std::memory_order_acquire);
+        while (bits) {
+            int exception = i * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            int priority = Priority(exception);
+            if (priority < bestPriority) {
+                best = exception;
+                bestPriority = priority;
+            }
+        }
+    }
+    if (best >= 0) {
+        pending[best / 64].fetch_and(~(1ULL << (best % 64)), std::memory_order_acq_rel);
+        RecordEntryLatency(best);
+    }
+    return best;
+}
+
+void NVIC::RecordEntryLatency(int exception)
+{
+    Histogram* histogram = latency[exception].load(std::memory_order_relaxed);
+    if (!histogram) {
+        latencyStorage[exception] = std::make_unique<Histogram>();
+        histogram = latencyStorage[exception].get();
+        latency[exception].store(histogram, std::memory_order_release);
+    }
+    u64 now = NowNanoseconds();
+    u64 trigger = triggerTimes[exception].load(std::memory_order_relaxed);
+    histogram->Record(now > trigger ? now - trigger : 0);
+}
+
+void NVIC::ReportEntryLatency()
+{
+    u64 now = NowNanoseconds();
+    if (now - lastReport < LATENCY_REPORT_INTERVAL) {
+        return;
+    }
+    lastReport = now;
+    for (int i = 0; i < NUM_EXCEPTIONS; i++) {
+        if (const Histogram* histogram = EntryLatency(i)) {
+            ext::LogDebug("NVIC: irq = %d, priority = %d, entry latency p50 = %.1f us, p99 = %.1f us, max = %.1f us (%llu samples)",
+                i, Priority(i), histogram->Percentile(50) / 1000.0, histogram->Percentile(99) / 1000.0, histogram->Max() / 1000.0, (unsigned long long)histogram->Count());
+        }
+    }
+}
+
+/* pending interrupts are not kept, their sources are timers that run again after a restore */
+void NVIC::SaveState(StateWriter& writer)
+{
+    for (const auto& priority : priorities) {
+        writer.Write(priority.load(std::memory_order_relaxed));
+    }
+}
+
+StateLoader NVIC::ParseState(StateReader& reader)
+{
+    std::array<u8, NUM_EXCEPTIONS> values;
+    for (auto& value : values) {
+        value = reader.Read<u8>();
+    }
+    if (!reader.Done()) {
+        return {};
+    }
+    return [this, values]() {
+        for (int i = 0; i < NUM_EXCEPTIONS; i++) {
+            priorities[i].store(values[i], std::memory_order_relaxed);
+        }
+    };
+}
+
+/* only the priority registers are modelled, software set-pending is ignored as before */
+u8 NVIC::ReadByte(u32 offset)
+{
+    if (offset >= NVIC_IPR_BEGIN && offset < NVIC_IPR_END) {
+        return priorities[16 + offset - NVIC_IPR_BEGIN].load(std::memory_order_relaxed);
+    } else if (offset >= SCB_SHPR_BEGIN && offset < SCB_SHPR_END) {
+        return priorities[4 + offset - SCB_SHPR_BEGIN].load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+void NVIC::WriteByte(u32 offset, u8 value)
+{
+    if (offset >= NVIC_IPR_BEGIN && offset < NVIC_IPR_END) {
+        priorities[16 + offset - NVIC_IPR_BEGIN].store(value, std::memory_order_relaxed);
+    } else if (offset >= SCB_SHPR_BEGIN && offset < SCB_SHPR_END) {
+        priorities[4 + offset - SCB_SHPR_BEGIN].store(value, std::memory_order_relaxed);
+    }
+}
+
+void NVIC::Read(u32 offset, void* buffer, u32 length)
+{
+    u8* ptr = (u8*)buffer;
+    for (u32 i = 0; i < length; i++) {
+        *ptr++ = ReadByte(offset + i);
+    }
+}
+
+void NVIC::Write(u32 offset, void* buffer, u32 length)
+{
+    u8* ptr = (u8*)buffer;
+    for (u32 i = 0; i < length; i++) {
+        WriteByte(offset + i, *ptr++);
+    }
+}
+
+u32 NVIC::Read32(u32 offset)
+{
+    u32 value;
+    Read(offset, &value, sizeof(value));
+    return value;
+}
+
+void NVIC::Write32(u32 offset, u32 value)
+{
+    Write(offset, &value, sizeof(value));
+}
+
+} // namespace m8
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "io.h"
+#include "stats.h"
+#include "snapshot.h"
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace m8 {
+
+/* System control space: pending bitmap, exception priorities and entry latency statistics */
+class NVIC : public Device {
+public:
+    static constexpr int NUM_EXCEPTIONS = 256;
+    static constexpr int THREAD_PRIORITY = 256; // below every configurable priority
+
+    NVIC(u32 baseAddr, u32 size);
+
+    void SetPending(int exception);
+    bool IsPending(int exception) const;
+    bool HasPending() const;
+    int AcknowledgePending(int activePriority);
+
+    int Priority(int exception) const { return priorities[exception].load(std::memory_order_relaxed); }
+    const Histogram* EntryLatency(int exception) const { return latency[exception].load(std::memory_order_acquire); }
+    void ReportEntryLatency();
+
+    void SaveState(StateWriter& writer);
+    StateLoader ParseState(StateReader& reader);
+
+    void Read(u32 offset, void* buffer, u32 length) override;
+    void Write(u32 offset, void* buffer, u32 length) override;
+
+    u32 Read32(u32 offset) override;
+    void Write32(u32 offset, u32 value) override;
+
+private:
+    static constexpr int NUM_WORDS = NUM_EXCEPTIONS / 64;
+
+    u8 ReadByte(u32 offset);
+    void WriteByte(u32 offset, u8 value);
+    void RecordEntryLatency(int exception);
+
+    std::array<std::atomic<u64>, NUM_WORDS> pending{};
+    std::array<std::atomic<u8>, NUM_EXCEPTIONS> priorities{};
+    std::array<std::atomic<u64>, NUM_EXCEPTIONS> triggerTimes{};
+    std::array<std::atomic<Histogram*>, NUM_EXCEPTIONS> latency{};
+    std::array<std::unique_ptr<Histogram>, NUM_EXCEPTIONS> latencyStorage;
+    u64 lastReport = 0;
+};
+
+} // namespace m8
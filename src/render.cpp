@@ -0,0 +1,220 @@
+#include "render.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <ext/log.h>
+
+#define AUDIO_BENCHMARK_BLOCKS 2048 // ~3 s of audio
+
+namespace m8 {
+
+OfflineRenderer::OfflineRenderer(M8Emulator& emu, M8AudioProcessor& audio) : emu(emu), audio(audio)
+{
+    audio.SetOffline([this](const int16_t* frames, std::size_t count) {
+        if (output) {
+            output->Write(frames, count);
+        }
+    });
+}
+
+bool OfflineRenderer::Render(const std::string& path, double seconds)
+{
+    WavWriter writer(M8AudioProcessor::SAMPLE_RATE, 2);
+    if (!writer.Open(path)) {
+        return false;
+    }
+    output = &writer;
+    auto timing = RenderBlocks(seconds * M8AudioProcessor::SAMPLE_RATE / M8AudioProcessor::BLOCK_SAMPLES);
+    output = nullptr;
+    bool ok = writer.Close();
+    audioSeconds = (double)writer.Frames() / M8AudioProcessor::SAMPLE_RATE;
+    wallSeconds = timing.wallSeconds;
+    ext::LogInfo("Render: %s, %.1f s of audio in %.1f s (%.1fx realtime)", path.c_str(), audioSeconds, wallSeconds,
+        wallSeconds > 0 ? audioSeconds / wallSeconds : 0.0);
+    return ok;
+}
+
+OfflineRenderer::Timing OfflineRenderer::RenderBlocks(u64 blocks)
+{
+    Timing timing;
+    auto& callbacks = emu.Callbacks();
+    u64 instructions = callbacks.Cycles();
+    u64 start = emu.EmulatedMicros();
+    auto wallStart = std::chrono::steady_clock::now();
+    for (u64 block = 1; block <= blocks; block++) {
+        u64 due = start + block * M8AudioProcessor::BLOCK_SAMPLES * 1000000 / M8AudioProcessor::SAMPLE_RATE;
+        while (emu.EmulatedMicros() < due) {
+            emu.Run();
+        }
+        auto audioStart = std::chrono::steady_clock::now();
+        u64 audioInstructions = callbacks.Cycles();
+        audio.Render();
+        timing.audioInstructions += callbacks.Cycles() - audioInstructions;
+        timing.audioWallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - audioStart).count();
+    }
+    timing.instructions = callbacks.Cycles() - instructions;
+    timing.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    return timing;
+}
+
+bool LoadRenderJobs(const std::string& path, double defaultSeconds, std::vector<RenderJob>& jobs)
+{
+    std::ifstream file(path);
+    if (!file) {
+        ext::LogError("Batch: failed to open %s", path.c_str());
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        std::istringstream fields(line);
+        RenderJob job{"", defaultSeconds, {}};
+        if (!(fields >> job.output) || job.output[0] == '#') {
+            continue;
+        }
+        std::string field;
+        while (fields >> field) {
+            auto at = field.rfind('@');
+            char* end = nullptr;
+            if (at == std::string::npos) {
+                job.seconds = strtod(field.c_str(), &end);
+            } else {
+                job.images.emplace_back(strtoul(field.c_str() + at + 1, &end, 0), field.substr(0, at));
+            }
+            if (!end || *end) {
+                ext::LogError("Batch: %s:%d: bad field '%s'", path.c_str(), number, field.c_str());
+                return false;
+            }
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+static bool LoadImage(M8Emulator& emu, u32 addr, const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        ext::LogError("Batch: failed to open %s", path.c_str());
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.empty()) {
+        return true;
+    }
+    auto& callbacks = emu.Callbacks();
+    auto* begin = (u8*)callbacks.MemoryMap(addr);
+    if (!begin || (u8*)callbacks.MemoryMap(addr + data.size() - 1) != begin + data.size() - 1) {
+        ext::LogError("Batch: %s doesn't fit in guest memory at 0x%x", path.c_str(), addr);
+        return false;
+    }
+    memcpy(begin, data.data(), data.size());
+    return true;
+}
+
+static bool RunJob(OfflineRenderer& renderer, M8Emulator& emu, const RenderJob& job)
+{
+    for (const auto& [addr, image] : job.images) {
+        if (!LoadImage(emu, addr, image)) {
+            return false;
+        }
+    }
+    return renderer.Render(job.output, job.seconds);
+}
+
+int RunRenderBatch(OfflineRenderer& renderer, M8Emulator& emu, const std::vector<RenderJob>& jobs, int concurrency)
+{
+    std::map<pid_t, std::size_t> running;
+    std::size_t next = 0;
+    int failed = 0;
+    int done = 0;
+    double audioSeconds = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (next < jobs.size() || !running.empty()) {
+        while (next < jobs.size() && (int)running.size() < concurrency) {
+            /* the child would flush the parent's buffered output again */
+            fflush(stdout);
+            fflush(stderr);
+            pid_t pid = fork();
+            if (pid == 0) {
+                bool ok = RunJob(renderer, emu, jobs[next]);
+                fflush(stdout);
+                fflush(stderr);
+                /* skip destructors, the worker threads of the parent's pools don't exist here */
+                _exit(ok ? 0 : 1);
+            }
+            if (pid < 0) {
+                ext::LogError("Batch: fork failed: %s", strerror(errno));
+                if (running.empty()) {
+                    return jobs.size() - (done - failed);
+                }
+                break;
+            }
+            running[pid] = next++;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ext::LogError("Batch: waitpid failed: %s", strerror(errno));
+            return jobs.size() - (done - failed);
+        }
+        auto iter = running.find(pid);
+        if (iter == running.end()) {
+            continue;
+        }
+        const auto& job = jobs[iter->second];
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            audioSeconds += job.seconds;
+        } else {
+            ext::LogError("Batch: %s failed", job.output.c_str());
+            failed++;
+        }
+        done++;
+        running.erase(iter);
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int rendered = done - failed;
+    printf("batch: %d songs rendered, %d failed, %.1f s of audio in %.1f s on %d workers, %.1f songs/hour, %.1fx realtime\n",
+        rendered, failed, audioSeconds, wall, concurrency, wall > 0 ? rendered * 3600 / wall : 0.0, wall > 0 ? audioSeconds / wall : 0.0);
+    return failed;
+}
+
+void RunAudioBenchmark(OfflineRenderer& renderer, M8Emulator& emu, const std::vector<u64>& slices)
+{
+    for (u64 slice : slices) {
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            emu.SetRunSlice(slice);
+            auto timing = renderer.RenderBlocks(AUDIO_BENCHMARK_BLOCKS);
+            printf("audio benchmark: run slice %llu, %.1f MIPS overall, audio update %.1f MIPS, %.1f us per block, %.1fx realtime\n",
+                (unsigned long long)slice, timing.wallSeconds > 0 ? timing.instructions / timing.wallSeconds / 1e6 : 0.0,
+                timing.audioWallSeconds > 0 ? timing.audioInstructions / timing.audioWallSeconds / 1e6 : 0.0,
+                timing.audioWallSeconds * 1e6 / AUDIO_BENCHMARK_BLOCKS,
+                timing.wallSeconds > 0 ? AUDIO_BENCHMARK_BLOCKS * M8AudioProcessor::BLOCK_SAMPLES / (double)M8AudioProcessor::SAMPLE_RATE / timing.wallSeconds : 0.0);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid < 0) {
+            ext::LogError("Benchmark: fork failed: %s", strerror(errno));
+            return;
+        }
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+} // namespace m8
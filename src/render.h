@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+#include "m8emu.h"
+#include "m8audio.h"
+#include "wavwriter.h"
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace m8 {
+
+/*
+ * Offline rendering: the emulator's scheduler runs on emulated time, the core
+ * runs up to each block's deadline and then one graph cycle produces the
+ * block, as fast as the host allows. Must be created before the emulator boots.
+ */
+class OfflineRenderer {
+public:
+    /* guest instructions and host time of a run of blocks, the audio part covers the graph cycles only */
+    struct Timing {
+        u64 instructions = 0;
+        u64 audioInstructions = 0;
+        double wallSeconds = 0;
+        double audioWallSeconds = 0;
+    };
+
+    OfflineRenderer(M8Emulator& emu, M8AudioProcessor& audio);
+    bool Render(const std::string& path, double seconds);
+    Timing RenderBlocks(u64 blocks);
+
+    double AudioSeconds() const { return audioSeconds; }
+    double WallSeconds() const { return wallSeconds; }
+
+private:
+    M8Emulator& emu;
+    M8AudioProcessor& audio;
+    WavWriter* output = nullptr;
+    double audioSeconds = 0;
+    double wallSeconds = 0;
+};
+
+/* one line of a batch file: output [seconds] [image@addr ...] */
+struct RenderJob {
+    std::string output;
+    double seconds;
+    std::vector<std::tuple<u32, std::string>> images; // copied into guest memory before rendering
+};
+
+bool LoadRenderJobs(const std::string& path, double defaultSeconds, std::vector<RenderJob>& jobs);
+
+/*
+ * Renders every job in a child forked from the booted emulator, so each one
+ * starts from the same memory, shared copy-on-write. At most concurrency
+ * children run at a time; returns the number of failed jobs.
+ */
+int RunRenderBatch(OfflineRenderer& renderer, M8Emulator& emu, const std::vector<RenderJob>& jobs, int concurrency);
+
+/* renders the same blocks from the booted state once per run slice, each in a forked child */
+void RunAudioBenchmark(OfflineRenderer& renderer, M8Emulator& emu, const std::vector<u64>& slices);
+
+} // namespace m8
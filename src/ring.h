@@ -0,0 +1,80 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+namespace m8 {
+
+/*
+ * Single producer, single consumer ring of trivially copyable elements with a
+ * power of two capacity allocated up front. Both sides copy in at most two
+ * memcpy calls and never block; a write that doesn't fit is truncated.
+ */
+template<class T> class SPSCRing {
+public:
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    explicit SPSCRing(std::size_t capacity)
+    {
+        std::size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        buffer = std::make_unique<T[]>(size);
+    }
+
+    std::size_t Capacity() const { return mask + 1; }
+    std::size_t Size() const
+    {
+        std::size_t t = tail.load(std::memory_order_acquire);
+        return head.load(std::memory_order_acquire) - t;
+    }
+    /* elements read since construction */
+    std::size_t Consumed() const { return tail.load(std::memory_order_relaxed); }
+
+    /* producer side, returns how many elements fit */
+    std::size_t Write(const T* data, std::size_t count)
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t t = tail.load(std::memory_order_acquire);
+        count = std::min(count, Capacity() - (h - t));
+        Copy(buffer.get(), h, data, count);
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    /* consumer side, returns how many elements were read */
+    std::size_t Read(T* data, std::size_t count)
+    {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t h = head.load(std::memory_order_acquire);
+        count = std::min(count, h - t);
+        std::size_t offset = t & mask;
+        std::size_t first = std::min(count, Capacity() - offset);
+        memcpy(data, buffer.get() + offset, first * sizeof(T));
+        memcpy(data + first, buffer.get(), (count - first) * sizeof(T));
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    void Copy(T* ring, std::size_t position, const T* data, std::size_t count)
+    {
+        std::size_t offset = position & mask;
+        std::size_t first = std::min(count, Capacity() - offset);
+        memcpy(ring + offset, data, first * sizeof(T));
+        memcpy(ring, data + first, (count - first) * sizeof(T));
+    }
+
+    std::unique_ptr<T[]> buffer;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
+
+} // namespace m8
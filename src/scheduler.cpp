@@ -0,0 +1,226 @@
+#include "scheduler.h"
+#include "timer.h"
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <algorithm>
+#include <ext/log.h>
+
+namespace m8 {
+
+static u64 MonotonicMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static u64 RotateRight(u64 value, int shift)
+{
+    return shift ? (value >> shift) | (value << (64 - shift)) : value;
+}
+
+Scheduler& Scheduler::Default()
+{
+    static Scheduler& scheduler = *[]() {
+        auto* scheduler = new Scheduler(MonotonicMicros);
+        scheduler->StartThread();
+        return scheduler;
+    }();
+    return scheduler;
+}
+
+Scheduler::Scheduler(Clock clock)
+{
+    SetClock(clock);
+}
+
+Scheduler::~Scheduler()
+{
+    if (timerfd >= 0) {
+        close(timerfd);
+    }
+}
+
+void Scheduler::SetClock(Clock clock)
+{
+    std::lock_guard lock(mutex);
+    this->clock = clock;
+    current = clock ? clock() : 0;
+}
+
+u64 Scheduler::Now()
+{
+    return clock ? clock() : current;
+}
+
+void Scheduler::Poll()
+{
+    if (threaded) {
+        return;
+    }
+    std::unique_lock lock(mutex);
+    Advance(Now(), lock);
+}
+
+void Scheduler::StartThread()
+{
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timerfd < 0) {
+        ext::LogError("Scheduler: timerfd_create failed: %s", strerror(errno));
+        std::terminate();
+    }
+    threaded = true;
+    thread = std::thread([this]() { ThreadLoop(); });
+}
+
+void Scheduler::ThreadLoop()
+{
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            Advance(Now(), lock);
+            Arm(NextEvent());
+        }
+        u64 expirations;
+        if (read(timerfd, &expirations, sizeof(expirations)) < 0 && errno != EINTR) {
+            ext::LogError("Scheduler: timerfd read failed: %s", strerror(errno));
+        }
+    }
+}
+
+void Scheduler::Arm(u64 tick)
+{
+    if (tick == armed) {
+        return;
+    }
+    armed = tick;
+    itimerspec spec{};
+    if (tick != ~0ULL) {
+        /* tick 0 would disarm the timer */
+        tick = std::max<u64>(tick, 1);
+        spec.it_value.tv_sec = tick / 1000000;
+        spec.it_value.tv_nsec = (tick % 1000000) * 1000;
+    }
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void Scheduler::Schedule(Timer* timer, u64 deadline)
+{
+    timer->deadline = deadline;
+    Insert(timer);
+    if (threaded && deadline < armed) {
+        Arm(NextEvent());
+    }
+}
+
+void Scheduler::Insert(Timer* timer)
+{
+    u64 deadline = std::max(timer->deadline, current);
+    u64 delta = std::min(deadline - current, MAX_DELTA);
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << ((level + 1) * SLOT_BITS))) {
+        level++;
+    }
+    int index = ((current + delta) >> (level * SLOT_BITS)) & SLOT_MASK;
+    Slot& slot = wheel[level][index];
+    timer->prev = nullptr;
+    timer->next = slot.head;
+    if (slot.head) {
+        slot.head->prev = timer;
+    }
+    slot.head = timer;
+    timer->level = level;
+    timer->slot = index;
+    occupied[level] |= 1ULL << index;
+}
+
+void Scheduler::Unlink(Timer* timer)
+{
+    Slot& slot = wheel[timer->level][timer->slot];
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        slot.head = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    if (!slot.head) {
+        occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    timer->prev = timer->next = nullptr;
+    timer->level = -1;
+}
+
+void Scheduler::Cascade(int level)
+{
+    int index = (current >> (level * SLOT_BITS)) & SLOT_MASK;
+    Timer* timer = wheel[level][index].head;
+    wheel[level][index].head = nullptr;
+    occupied[level] &= ~(1ULL << index);
+    while (timer) {
+        Timer* next = timer->next;
+        Insert(timer);
+        timer = next;
+    }
+}
+
+u64 Scheduler::NextEvent()
+{
+    u64 next = ~0ULL;
+    for (int level = 0; level < LEVELS; level++) {
+        if (!occupied[level]) {
+            continue;
+        }
+        int shift = level * SLOT_BITS;
+        u64 position = current >> shift;
+        u64 rotated = RotateRight(occupied[level], position & SLOT_MASK);
+        /* the slot under the cursor of an upper level was cascaded already, it is one full turn away */
+        if (level > 0) {
+            rotated &= ~1ULL;
+        }
+        u64 offset = rotated ? __builtin_ctzll(rotated) : SLOTS;
+        next = std::min(next, (position + offset) << shift);
+    }
+    return next;
+}
+
+void Scheduler::Advance(u64 now, std::unique_lock<std::mutex>& lock)
+{
+    while (current <= now) {
+        for (int level = LEVELS - 1; level > 0; level--) {
+            if ((current & ((1ULL << (level * SLOT_BITS)) - 1)) == 0) {
+                Cascade(level);
+            }
+        }
+        Slot& slot = wheel[0][current & SLOT_MASK];
+        while (Timer* timer = slot.head) {
+            Unlink(timer);
+            if (timer->oneshot) {
+                timer->enabled = false;
+            }
+            auto callback = timer->callback;
+            runningTimer = timer;
+            runningThread = std::this_thread::get_id();
+            lock.unlock();
+            if (callback) {
+                callback(*timer);
+            }
+            lock.lock();
+            if (runningTimer == timer && timer->enabled && timer->level < 0) {
+                u64 deadline = timer->deadline + timer->interval.count();
+                Schedule(timer, deadline > now ? deadline : now + timer->interval.count());
+            }
+            runningTimer = nullptr;
+            runningThread = {};
+            callbackDone.notify_all();
+        }
+        current = std::max(current + 1, std::min(NextEvent(), now + 1));
+    }
+}
+
+} // namespace m8
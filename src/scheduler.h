@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace m8 {
+
+class Timer;
+
+/*
+ * Hierarchical timer wheel with 1 us ticks shared by every Timer bound to it.
+ * Default() is driven by one thread sleeping on a timerfd, other instances are
+ * driven by Poll() against a caller supplied clock (e.g. emulated cycles).
+ */
+class Scheduler {
+public:
+    using Clock = std::function<u64()>; // microseconds
+
+    static Scheduler& Default();
+
+    explicit Scheduler(Clock clock = nullptr);
+    ~Scheduler();
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    void SetClock(Clock clock);
+    u64 Now();
+    void Poll();
+    bool Threaded() const { return threaded; }
+
+private:
+    friend class Timer;
+
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr u64 SLOT_MASK = SLOTS - 1;
+    static constexpr u64 MAX_DELTA = (1ULL << (LEVELS * SLOT_BITS)) - 1;
+
+    struct Slot {
+        Timer* head = nullptr;
+    };
+
+    void StartThread();
+    void ThreadLoop();
+
+    void Schedule(Timer* timer, u64 deadline);
+
+    void Insert(Timer* timer);
+    void Unlink(Timer* timer);
+    void Cascade(int level);
+    void Advance(u64 now, std::unique_lock<std::mutex>& lock);
+    u64 NextEvent();
+    void Arm(u64 tick);
+
+    std::mutex mutex;
+    std::condition_variable callbackDone;
+    Clock clock;
+    u64 current = 0;
+    std::array<std::array<Slot, SLOTS>, LEVELS> wheel;
+    std::array<u64, LEVELS> occupied{};
+    Timer* runningTimer = nullptr; // cleared when the callback destroys its own timer
+    std::thread::id runningThread;
+
+    bool threaded = false;
+    int timerfd = -1;
+    u64 armed = ~0ULL;
+    std::thread thread;
+};
+
+} // namespace m8
@@ -0,0 +1,164 @@
+#include "snapshot.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <ext/log.h>
+
+#define SNAPSHOT_MAGIC   "M8SNAP\0\0"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN   4096
+
+namespace m8 {
+
+struct SnapshotHeader {
+    char magic[8];
+    u32 version;
+    u32 sectionCount;
+    u32 memoryCount;
+    u32 reserved;
+    u64 stamp;
+};
+
+struct SnapshotMemoryEntry {
+    u32 addr;
+    u32 size;
+    u64 offset;
+};
+
+static u64 AlignUp(u64 value)
+{
+    return (value + SNAPSHOT_ALIGN - 1) & ~(u64)(SNAPSHOT_ALIGN - 1);
+}
+
+void Snapshot::AddMemory(u32 addr, const u8* memory, u32 size)
+{
+    memories.push_back({addr, size, memory, 0});
+}
+
+void Snapshot::AddSection(const std::string& name, std::vector<u8> data)
+{
+    sections[name] = std::move(data);
+}
+
+bool Snapshot::Save(const std::string& path, u64 stamp)
+{
+    StateWriter writer;
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.sectionCount = sections.size();
+    header.memoryCount = memories.size();
+    header.stamp = stamp;
+    writer.Write(header);
+    for (const auto& [name, data] : sections) {
+        writer.Write<u32>(name.size());
+        writer.WriteBytes(name.data(), name.size());
+        writer.Write<u64>(data.size());
+        writer.WriteBytes(data.data(), data.size());
+    }
+
+    u64 offset = AlignUp(writer.data.size() + memories.size() * sizeof(SnapshotMemoryEntry));
+    for (auto& memory : memories) {
+        memory.fileOffset = offset;
+        writer.Write(SnapshotMemoryEntry{memory.addr, memory.size, offset});
+        offset = AlignUp(offset + memory.size);
+    }
+    writer.data.resize(AlignUp(writer.data.size()));
+
+    auto temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+        ext::LogError("Snapshot: failed to create %s: %s", temp.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(writer.data.data(), 1, writer.data.size(), file) == writer.data.size();
+    for (const auto& memory : memories) {
+        ok = ok && fseek(file, memory.fileOffset, SEEK_SET) == 0;
+        ok = ok && fwrite(memory.data, 1, memory.size, file) == memory.size;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        ext::LogError("Snapshot: failed to write %s: %s", path.c_str(), strerror(errno));
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Snapshot::Load(const std::string& path, u64 stamp)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bool ok = true;
+    SnapshotHeader header{};
+    ok = fread(&header, sizeof(header), 1, file) == 1;
+    if (!ok || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+        ext::LogError("Snapshot: %s is not a snapshot file", path.c_str());
+        fclose(file);
+        return false;
+    }
+    if (header.stamp != stamp) {
+        ext::LogInfo("Snapshot: %s was taken from another firmware, ignored", path.c_str());
+        fclose(file);
+        return false;
+    }
+    for (u32 i = 0; ok && i < header.sectionCount; i++) {
+        u32 nameLength = 0;
+        u64 size = 0;
+        std::string name;
+        ok = fread(&nameLength, sizeof(nameLength), 1, file) == 1 && nameLength < 256;
+        if (ok) {
+            name.resize(nameLength);
+            ok = fread(name.data(), 1, nameLength, file) == nameLength && fread(&size, sizeof(size), 1, file) == 1;
+        }
+        if (ok) {
+            auto& data = sections[name];
+            data.resize(size);
+            ok = fread(data.data(), 1, size, file) == size;
+        }
+    }
+    for (u32 i = 0; ok && i < header.memoryCount; i++) {
+        SnapshotMemoryEntry entry;
+        ok = fread(&entry, sizeof(entry), 1, file) == 1;
+        memories.push_back({entry.addr, entry.size, nullptr, entry.offset});
+    }
+    fclose(file);
+    if (!ok) {
+        ext::LogError("Snapshot: %s is truncated", path.c_str());
+        return false;
+    }
+    this->path = path;
+    return true;
+}
+
+bool Snapshot::MapMemory(MemoryArena& arena)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ext::LogError("Snapshot: failed to open %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    for (const auto& memory : memories) {
+        /* private mapping: guest writes land in anonymous copies, the file stays untouched */
+        void* ptr = mmap(arena.Base() + memory.addr, memory.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, memory.fileOffset);
+        if (ptr == MAP_FAILED) {
+            ext::LogError("Snapshot: failed to map 0x%x (size 0x%x): %s", memory.addr, memory.size, strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+const std::vector<u8>* Snapshot::Section(const std::string& name) const
+{
+    auto iter = sections.find(name);
+    return iter != sections.end() ? &iter->second : nullptr;
+}
+
+} // namespace m8
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "common.h"
+#include "arena.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+namespace m8 {
+
+class StateWriter {
+public:
+    template<class T> void Write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        WriteBytes(&value, sizeof(value));
+    }
+    void WriteBytes(const void* buffer, std::size_t length)
+    {
+        auto* ptr = (const u8*)buffer;
+        data.insert(data.end(), ptr, ptr + length);
+    }
+
+    std::vector<u8> data;
+};
+
+class StateReader {
+public:
+    StateReader(const std::vector<u8>& data) : data(data) {}
+
+    template<class T> T Read()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value{};
+        ReadBytes(&value, sizeof(value));
+        return value;
+    }
+    bool ReadBytes(void* buffer, std::size_t length)
+    {
+        if (position + length > data.size()) {
+            ok = false;
+            return false;
+        }
+        memcpy(buffer, data.data() + position, length);
+        position += length;
+        return true;
+    }
+    bool Ok() const { return ok; }
+    bool Done() const { return ok && position == data.size(); } // read exactly to the end
+
+private:
+    const std::vector<u8>& data;
+    std::size_t position = 0;
+    bool ok = true;
+};
+
+/* applies a parsed state section once guest memory is restored, empty when the section is short or corrupt */
+using StateLoader = std::function<void()>;
+
+/*
+ * Snapshot file: a header with the section and memory tables, the state
+ * sections, then page aligned memory images which are mapped back into the
+ * arena copy-on-write, so restoring costs a few mmap calls.
+ */
+class Snapshot {
+public:
+    void AddMemory(u32 addr, const u8* memory, u32 size);
+    void AddSection(const std::string& name, std::vector<u8> data);
+    bool Save(const std::string& path, u64 stamp);
+
+    bool Load(const std::string& path, u64 stamp);
+    bool MapMemory(MemoryArena& arena);
+    const std::vector<u8>* Section(const std::string& name) const;
+
+private:
+    struct Memory {
+        u32 addr;
+        u32 size;
+        const u8* data;
+        u64 fileOffset;
+    };
+
+    std::vector<Memory> memories;
+    std::map<std::string, std::vector<u8>> sections;
+    std::string path;
+};
+
+} // namespace m8
@@ -0,0 +1,73 @@
+#include "stats.h"
+#include <algorithm>
+
+namespace m8 {
+
+int Histogram::BucketIndex(u64 value)
+{
+    if (value < (1 << SUB_BUCKET_BITS)) {
+        return value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - SUB_BUCKET_BITS;
+    return ((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & ((1 << SUB_BUCKET_BITS) - 1));
+}
+
+u64 Histogram::BucketUpperBound(int index)
+{
+    if (index < (1 << SUB_BUCKET_BITS)) {
+        return index;
+    }
+    int shift = (index >> SUB_BUCKET_BITS) - 1;
+    u64 sub = index & ((1 << SUB_BUCKET_BITS) - 1);
+    u64 lower = ((1ULL << SUB_BUCKET_BITS) + sub) << shift;
+    return lower + ((1ULL << shift) - 1);
+}
+
+void Histogram::Record(u64 value)
+{
+    buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    u64 current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::Reset()
+{
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+u64 Histogram::Mean() const
+{
+    u64 n = Count();
+    return n ? sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+u64 Histogram::Percentile(double p) const
+{
+    u64 n = Count();
+    if (n == 0) {
+        return 0;
+    }
+    u64 target = (u64)(p / 100.0 * n);
+    if (target >= n) {
+        target = n - 1;
+    }
+    u64 seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > target) {
+            return std::min(BucketUpperBound(i), Max());
+        }
+    }
+    return Max();
+}
+
+} // namespace m8
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+#include <atomic>
+
+namespace m8 {
+
+/* Lock-free log-linear histogram, each power of two split into 8 buckets (<12.5% error) */
+class Histogram {
+public:
+    void Record(u64 value);
+    void Reset();
+
+    u64 Count() const { return count.load(std::memory_order_relaxed); }
+    u64 Max() const { return max.load(std::memory_order_relaxed); }
+    u64 Mean() const;
+    u64 Percentile(double p) const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    static int BucketIndex(u64 value);
+    static u64 BucketUpperBound(int index);
+
+    std::array<std::atomic<u64>, NUM_BUCKETS> buckets{};
+    std::atomic<u64> count{0};
+    std::atomic<u64> sum{0};
+    std::atomic<u64> max{0};
+};
+
+} // namespace m8
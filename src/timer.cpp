@@ -2,63 +2,64 @@
 
 namespace m8 {
 
-Timer::Timer()
+Timer::Timer(Scheduler& scheduler) : scheduler(scheduler)
 {
-    running = true;
-    thread = std::thread([this] {
-        auto now = std::chrono::steady_clock::now();
-        while (running) {
-            std::unique_lock lock(mutex);
-            if (!enabled) {
-                wakeup.wait(lock, [this]() { return enabled || !running; });
-                now = std::chrono::steady_clock::now();
-            }
-            if (enabled) {
-                std::this_thread::sleep_until(now + interval);
-                now = std::chrono::steady_clock::now();
-                callback(*this);
-                if (oneshot) {
-                    Stop();
-                }
-            }
-        }
-    });
 }
 
 Timer::~Timer()
 {
-    if (running) {
-        running = false;
-        wakeup.notify_all();
-        thread.join();
+    std::unique_lock lock(scheduler.mutex);
+    enabled = false;
+    /* from a callback on the thread running it: waiting would deadlock, Advance skips the rearm instead */
+    if (std::this_thread::get_id() == scheduler.runningThread) {
+        if (scheduler.runningTimer == this) {
+            scheduler.runningTimer = nullptr;
+        }
+    } else {
+        scheduler.callbackDone.wait(lock, [this]() { return scheduler.runningTimer != this; });
+    }
+    if (level >= 0) {
+        scheduler.Unlink(this);
     }
 }
 
 void Timer::SetOneshot(bool oneshot)
 {
-    std::unique_lock lock(mutex);
+    std::lock_guard lock(scheduler.mutex);
     this->oneshot = oneshot;
 }
 
 void Timer::SetInterval(std::chrono::microseconds interval, std::function<void(Timer&)> callback)
 {
-    std::unique_lock lock(mutex);
+    std::lock_guard lock(scheduler.mutex);
     this->callback = callback;
     this->interval = interval;
 }
 
+void Timer::SetPeriod(std::chrono::microseconds interval)
+{
+    std::lock_guard lock(scheduler.mutex);
+    this->interval = interval;
+}
+
 void Timer::Start()
 {
-    std::unique_lock lock(mutex);
+    std::lock_guard lock(scheduler.mutex);
     if (!enabled) {
         enabled = true;
-        wakeup.notify_all();
+        if (level < 0) {
+            scheduler.Schedule(this, scheduler.Now() + interval.count());
+        }
     }
 }
 
 void Timer::Stop()
 {
+    std::lock_guard lock(scheduler.mutex);
     enabled = false;
+    if (level >= 0) {
+        scheduler.Unlink(this);
+    }
 }
 
 } // namespace m8
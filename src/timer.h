@@ -1,31 +1,37 @@
 #pragma once
 
-#include <thread>
-#include <atomic>
 #include <functional>
 #include <chrono>
-#include <condition_variable>
+#include "scheduler.h"
 
 namespace m8 {
 
 class Timer {
 public:
-    Timer();
+    explicit Timer(Scheduler& scheduler = Scheduler::Default());
     ~Timer();
     void SetInterval(std::chrono::microseconds interval, std::function<void(Timer&)> callback);
+    /* takes effect from the next expiry, callable from the callback */
+    void SetPeriod(std::chrono::microseconds interval);
     void SetOneshot(bool oneshot);
     void Start();
     void Stop();
 
 private:
-    std::atomic<bool> running{false};
-    std::atomic<bool> enabled{false};
+    friend class Scheduler;
+
+    Scheduler& scheduler;
+    bool enabled = false;
     bool oneshot = false;
     std::function<void(Timer&)> callback;
-    std::chrono::microseconds interval;
-    std::thread thread;
-    std::mutex mutex;
-    std::condition_variable wakeup;
+    std::chrono::microseconds interval{0};
+
+    /* wheel links, guarded by the scheduler mutex */
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    u64 deadline = 0;
+    int level = -1;
+    int slot = 0;
 };
 
 } // namespace m8
@@ -19,13 +19,17 @@ static_assert(sizeof(EndpointQueueHead) == 64);
 
 using namespace std::chrono_literals;
 
-USB::USB(CoreCallbacks& cb, u32 baseAddr, u32 size) : RegisterDevice(baseAddr, size), callbacks(cb)
+USB::USB(CoreCallbacks& cb, Scheduler& scheduler, u32 baseAddr, u32 size) : RegisterDevice(baseAddr, size), callbacks(cb), scheduler(scheduler)
 {
     for (int i = 0; i < NUMS_ENDPOINT; i++) {
-        gpTimers.push_back(std::make_shared<Timer>());
+        gpTimers.push_back(std::make_shared<Timer>(scheduler));
     }
     gpTimerInterrupts.resize(NUMS_GPTIMER);
+    gpTimerLoads.resize(NUMS_GPTIMER);
+    gpTimerControls.resize(NUMS_GPTIMER);
     endpointBuffers.resize(NUMS_ENDPOINT);
+    endpointStreams.resize(NUMS_ENDPOINT);
+    endpointReadBuffers.resize(NUMS_ENDPOINT);
     endpointTxTypes.resize(NUMS_ENDPOINT);
     endpointRxTypes.resize(NUMS_ENDPOINT);
     endpointIsocTxTimers.resize(NUMS_ENDPOINT);
@@ -34,6 +38,7 @@ USB::USB(CoreCallbacks& cb, u32 baseAddr, u32 size) : RegisterDevice(baseAddr, s
     for (u32 i = 0; i < NUMS_GPTIMER; i++) {
         REG32(GPTIMERiLD, 0x80 + i * 8);
         auto callback = [i, this](u32 v) {
+            gpTimerLoads[i] = v;
             gpTimers[i]->SetInterval((v + 1) * 1us, [i, this](Timer&) {
                 gpTimerInterrupts[i] = true;
                 UpdateInterrupts();
@@ -42,6 +47,7 @@ USB::USB(CoreCallbacks& cb, u32 baseAddr, u32 size) : RegisterDevice(baseAddr, s
         FIELD(GPTIMERiLD, VALUE, 0, 24, R(0), callback);
         REG32(GPTIMERiCTRL, 0x84 + i * 8);
         GPTIMERiCTRL.writeCallback = [i, this](u32 v) {
+            gpTimerControls[i] = v;
             bool oneshot = !(v & (1 << 24));
             gpTimers[i]->SetOneshot(oneshot);
             if (v & (1 << 31)) {
@@ -109,6 +115,92 @@ USB::USB(CoreCallbacks& cb, u32 baseAddr, u32 size) : RegisterDevice(baseAddr, s
     BindRegister(ENDPTCOMPLETE);
 }
 
+void USB::SaveState(StateWriter& writer)
+{
+    writer.Write(setupTripWire);
+    writer.Write(addDTDTripWire);
+    writer.Write(portChangeDetect);
+    writer.Write(interrupt);
+    for (u32 i = 0; i < NUMS_GPTIMER; i++) {
+        writer.Write<bool>(gpTimerInterrupts[i]);
+        writer.Write(gpTimerLoads[i]);
+        writer.Write(gpTimerControls[i]);
+    }
+    writer.Write(endpointPrimeTx);
+    writer.Write(endpointPrimeRx);
+    writer.Write(endpointBufferReadyTx);
+    writer.Write(endpointBufferReadyRx);
+    writer.Write(endpointCompleteTx);
+    writer.Write(endpointCompleteRx);
+    writer.Write(endpointListAddress);
+    writer.Write(endpointSetupStatus);
+    for (u32 i = 0; i < NUMS_ENDPOINT; i++) {
+        writer.Write(endpointTxTypes[i]);
+        writer.Write(endpointRxTypes[i]);
+    }
+}
+
+StateLoader USB::ParseState(StateReader& reader)
+{
+    struct State {
+        bool setupTripWire, addDTDTripWire, portChangeDetect, interrupt;
+        std::vector<bool> timerInterrupts;
+        std::vector<u32> timerLoads, timerControls;
+        u8 primeTx, primeRx, bufferReadyTx, bufferReadyRx, completeTx, completeRx;
+        u32 listAddress;
+        u16 setupStatus;
+        std::vector<EndpointType> txTypes, rxTypes;
+    } state;
+    state.setupTripWire = reader.Read<bool>();
+    state.addDTDTripWire = reader.Read<bool>();
+    state.portChangeDetect = reader.Read<bool>();
+    state.interrupt = reader.Read<bool>();
+    for (u32 i = 0; i < NUMS_GPTIMER; i++) {
+        state.timerInterrupts.push_back(reader.Read<bool>());
+        state.timerLoads.push_back(reader.Read<u32>());
+        state.timerControls.push_back(reader.Read<u32>());
+    }
+    state.primeTx = reader.Read<u8>();
+    state.primeRx = reader.Read<u8>();
+    state.bufferReadyTx = reader.Read<u8>();
+    state.bufferReadyRx = reader.Read<u8>();
+    state.completeTx = reader.Read<u8>();
+    state.completeRx = reader.Read<u8>();
+    state.listAddress = reader.Read<u32>();
+    state.setupStatus = reader.Read<u16>();
+    for (u32 i = 0; i < NUMS_ENDPOINT; i++) {
+        state.txTypes.push_back(reader.Read<EndpointType>());
+        state.rxTypes.push_back(reader.Read<EndpointType>());
+    }
+    if (!reader.Done()) {
+        return {};
+    }
+    return [this, state = std::move(state)]() {
+        setupTripWire = state.setupTripWire;
+        addDTDTripWire = state.addDTDTripWire;
+        portChangeDetect = state.portChangeDetect;
+        interrupt = state.interrupt;
+        for (u32 i = 0; i < NUMS_GPTIMER; i++) {
+            gpTimerInterrupts[i] = state.timerInterrupts[i];
+            /* replay the register writes so the timers are set up and started again */
+            Write32(0x80 + i * 8, state.timerLoads[i]);
+            Write32(0x84 + i * 8, state.timerControls[i]);
+        }
+        endpointPrimeTx = state.primeTx;
+        endpointPrimeRx = state.primeRx;
+        endpointCompleteTx = state.completeTx;
+        endpointCompleteRx = state.completeRx;
+        endpointSetupStatus = state.setupStatus;
+        endpointTxTypes = state.txTypes;
+        endpointRxTypes = state.rxTypes;
+        if (state.listAddress) {
+            UpdateEndpointListAddress(state.listAddress);
+        }
+        endpointBufferReadyTx = state.bufferReadyTx;
+        endpointBufferReadyRx = state.bufferReadyRx;
+    };
+}
+
 void USB::UpdateInterrupts()
 {
     bool irq = interrupt;
@@ -136,7 +228,7 @@ void USB::UpdateEndpointPrimeTx(u8 tx)
                             assert(setupCallback != nullptr);
                             setupCallback(data, td->totalBytes);
                             setupCallback = nullptr;
-                        } else {
+                        } else if (!endpointStreams[i]) {
                             std::lock_guard lock(mutex);
                             endpointBuffers[i].push(data, td->totalBytes);
                             if (endpointBuffers[i].size() > ENDPOINT_BUFFER_SIZE) {
@@ -235,7 +327,7 @@ void USB::HandleDataRead(int ep, int interval, std::size_t limit, std::function<
 {
     if (endpointTxTypes[ep] == EndpointType::Isochronous) {
         if (!endpointIsocTxTimers[ep]) {
-            endpointIsocTxTimers[ep] = std::make_shared<Timer>();
+            endpointIsocTxTimers[ep] = std::make_shared<Timer>(scheduler);
             endpointIsocTxTimers[ep]->SetInterval(interval * 125us, [ep, this, limit](Timer&) {
                 mutex.lock();
                 if (endpointTxCallbacks[ep].empty()) {
@@ -246,13 +338,12 @@ void USB::HandleDataRead(int ep, int interval, std::size_t limit, std::function<
 //                    interrupt = true;
 //                    UpdateInterrupts();
                     mutex.lock();
-                    auto callback = endpointTxCallbacks[ep].front();
+                    auto callback = std::move(endpointTxCallbacks[ep].front());
                     endpointTxCallbacks[ep].pop();
-                    auto size = std::min(limit, endpointBuffers[ep].size());
-                    std::vector<uint8_t> buffer(size);
-                    endpointBuffers[ep].pop(buffer.data(), size);
                     mutex.unlock();
-                    callback(buffer.data(), size);
+                    uint8_t* data;
+                    auto size = PopData(ep, limit, data);
+                    callback(data, size);
                 }
             });
             endpointIsocTxTimers[ep]->Start();
@@ -263,17 +354,59 @@ void USB::HandleDataRead(int ep, int interval, std::size_t limit, std::function<
         endpointCompleteTx |= 1 << ep;
         interrupt = true;
         UpdateInterrupts();
-        mutex.lock();
-        auto size = std::min(limit, endpointBuffers[ep].size());
-        std::vector<uint8_t> buffer(size);
-        endpointBuffers[ep].pop(buffer.data(), size);
-        mutex.unlock();
-        callback(buffer.data(), size);
+        uint8_t* data;
+        auto size = PopData(ep, limit, data);
+        callback(data, size);
     }
 }
 
+/* the read buffer is kept per endpoint and only grows, each endpoint has a single reader */
+std::size_t USB::PopData(int ep, std::size_t limit, uint8_t*& data)
+{
+    auto& buffer = endpointReadBuffers[ep];
+    if (buffer.size() < limit) {
+        buffer.resize(limit);
+    }
+    data = buffer.data();
+    if (auto& stream = endpointStreams[ep]) {
+        auto size = stream->ring.Read(data, limit);
+        if (size == 0 && stream->ring.Consumed() != 0) {
+            stream->underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        return size;
+    }
+    std::lock_guard lock(mutex);
+    auto size = std::min(limit, endpointBuffers[ep].size());
+    endpointBuffers[ep].pop(data, size);
+    return size;
+}
+
+void USB::SetStreamEndpoint(int ep)
+{
+    endpointStreams[ep] = std::make_unique<StreamEndpoint>(ENDPOINT_BUFFER_SIZE);
+}
+
+StreamLevel USB::GetStreamLevel(int ep)
+{
+    StreamLevel level;
+    if (auto& stream = endpointStreams[ep]) {
+        level.buffered = stream->ring.Size();
+        level.capacity = stream->ring.Capacity();
+        level.consumed = stream->ring.Consumed();
+        level.dropped = stream->dropped.load(std::memory_order_relaxed);
+        level.underruns = stream->underruns.load(std::memory_order_relaxed);
+    }
+    return level;
+}
+
 void USB::PushData(int ep, uint8_t* data, std::size_t length)
 {
+    if (auto& stream = endpointStreams[ep]) {
+        if (auto written = stream->ring.Write(data, length); written < length) {
+            stream->dropped.fetch_add(length - written, std::memory_order_relaxed);
+        }
+        return;
+    }
     std::lock_guard lock(mutex);
     endpointBuffers[ep].push(data, length);
     if (endpointBuffers[ep].size() > ENDPOINT_BUFFER_SIZE) {
@@ -3,6 +3,9 @@
 #include "usbip-internal.h"
 #include "emu.h"
 #include "timer.h"
+#include "snapshot.h"
+#include "ring.h"
+#include "audioclock.h"
 #include <ext/cqueue.h>
 #include <queue>
 
@@ -14,6 +17,9 @@ public:
     virtual void HandleDataWrite(int ep, int interval, uint8_t* data, std::size_t length) = 0;
     virtual void HandleDataRead(int ep, int interval, std::size_t limit, std::function<void(uint8_t*, std::size_t)> callback) = 0;
     virtual void PushData(int ep, uint8_t* data, std::size_t length) = 0;
+    /* PushData() on this endpoint comes from one host thread, it goes through a lock-free ring */
+    virtual void SetStreamEndpoint(int ep) = 0;
+    virtual StreamLevel GetStreamLevel(int ep) = 0;
 };
 
 enum class EndpointType {
@@ -67,21 +73,28 @@ struct __attribute__ ((__packed__)) EndpointTransferDescriptor {
 
 class USB : public RegisterDevice, public USBDevice {
 public:
-    USB(CoreCallbacks& callbacks, u32 baseAddr, u32 size);
+    USB(CoreCallbacks& callbacks, Scheduler& scheduler, u32 baseAddr, u32 size);
 
     void HandleSetupPacket(USBIP_SETUP_BYTES setup, uint8_t* data, std::size_t length, std::function<void(uint8_t*, std::size_t)> callback) override;
     void HandleDataWrite(int ep, int interval, uint8_t* data, std::size_t length) override;
     void HandleDataRead(int ep, int interval, std::size_t limit, std::function<void(uint8_t*, std::size_t)> callback) override;
     void PushData(int ep, uint8_t* data, std::size_t length) override;
+    void SetStreamEndpoint(int ep) override;
+    StreamLevel GetStreamLevel(int ep) override;
+
+    void SaveState(StateWriter& writer);
+    StateLoader ParseState(StateReader& reader);
 
 private:
     void UpdateInterrupts();
     void UpdateEndpointPrimeTx(u8 tx);
     void UpdateEndpointPrimeRx(u8 rx);
     void UpdateEndpointListAddress(u32 address);
+    std::size_t PopData(int ep, std::size_t limit, uint8_t*& data);
 
 private:
     CoreCallbacks& callbacks;
+    Scheduler& scheduler;
     ext::cqueue<uint8_t> setupBuffer;
     std::function<void(uint8_t*, std::size_t)> setupCallback;
 
@@ -91,6 +104,8 @@ private:
     bool interrupt = false;
     std::vector<std::shared_ptr<Timer>> gpTimers;
     std::vector<bool> gpTimerInterrupts;
+    std::vector<u32> gpTimerLoads;
+    std::vector<u32> gpTimerControls;
     std::vector<std::shared_ptr<Timer>> endpointIsocTxTimers;
 
     u8 endpointPrimeTx = 0;
@@ -104,6 +119,14 @@ private:
 
     EndpointQueueHead* endpointQueueHead;
     std::vector<ext::cqueue<uint8_t>> endpointBuffers;
+    struct StreamEndpoint {
+        explicit StreamEndpoint(std::size_t capacity) : ring(capacity) {}
+        SPSCRing<uint8_t> ring;
+        std::atomic<u64> dropped{0};
+        std::atomic<u64> underruns{0};
+    };
+    std::vector<std::unique_ptr<StreamEndpoint>> endpointStreams;
+    std::vector<std::vector<uint8_t>> endpointReadBuffers;
     std::vector<EndpointType> endpointTxTypes;
     std::vector<EndpointType> endpointRxTypes;
     std::vector<std::queue<std::function<void(uint8_t*, std::size_t)>>> endpointTxCallbacks;
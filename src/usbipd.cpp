@@ -4,11 +4,9 @@
 #include <cassert>
 #include <cstring>
 
-#define USBIP_SERVER_PORT 3240
-
 namespace m8 {
 
-USBIPServer::USBIPServer(uvw::loop& loop, USBDevice& device) : loop(loop), device(device)
+USBIPServer::USBIPServer(uvw::loop& loop, USBDevice& device, int port) : loop(loop), port(port), device(device)
 {
 }
 
@@ -25,7 +23,7 @@ void USBIPServer::Start()
         srv.accept(*client);
         client->read();
     });
-    server->bind("0.0.0.0", USBIP_SERVER_PORT);
+    server->bind("0.0.0.0", port);
     server->listen();
 }
 
@@ -129,7 +127,6 @@ void USBIPServer::HandleURBRequest(USBIP_CMD_SUBMIT& req, uint8_t* data, std::si
 
 void USBIPServer::OnClientDataEvent(const uvw::data_event& event, uvw::tcp_handle& client)
 {
-    static USBIP_CMD_SUBMIT urbRequest;
     buffer.push(event.data.get(), event.length);
     USBIPState last;
     do {
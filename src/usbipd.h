@@ -21,7 +21,9 @@ enum class USBIPState {
 
 class USBIPServer {
 public:
-    USBIPServer(uvw::loop& loop, USBDevice& device);
+    static constexpr int DEFAULT_PORT = 3240;
+
+    USBIPServer(uvw::loop& loop, USBDevice& device, int port = DEFAULT_PORT);
     void Start();
 
 private:
@@ -33,10 +35,12 @@ private:
 private:
     ext::cqueue<uint8_t> buffer;
     USBIPState state = USBIPState::WaitCommand;
+    USBIP_CMD_SUBMIT urbRequest;
 
     std::mutex mutex;
     uvw::loop& loop;
     std::shared_ptr<uvw::tcp_handle> server;
+    int port;
 
     USBDevice& device;
 };
@@ -0,0 +1,132 @@
+#include "wavwriter.h"
+#include <cerrno>
+#include <cstring>
+#include <ext/log.h>
+
+#define WAV_BUFFER_SAMPLES (1 << 18) // ~3 s of 44.1 kHz stereo
+#define WAV_CHUNK_SAMPLES  8192
+#define WAV_HEADER_SIZE    44
+
+namespace m8 {
+
+WavWriter::WavWriter(u32 sampleRate, u32 channels) : sampleRate(sampleRate), channels(channels), ring(WAV_BUFFER_SAMPLES)
+{
+}
+
+WavWriter::~WavWriter()
+{
+    Close();
+}
+
+bool WavWriter::Open(const std::string& path)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        ext::LogError("WavWriter: failed to create %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    raw = path.size() >= 4 && path.compare(path.size() - 4, 4, ".raw") == 0;
+    /* placeholder sizes, patched in Close() */
+    if (!raw && !WriteHeader()) {
+        ext::LogError("WavWriter: failed to write %s: %s", path.c_str(), strerror(errno));
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+    thread = std::thread([this]() { WriterLoop(); });
+    return true;
+}
+
+bool WavWriter::WriteHeader()
+{
+    u32 dataSize = frames * channels * sizeof(int16_t);
+    u16 blockAlign = channels * sizeof(int16_t);
+    u8 header[WAV_HEADER_SIZE];
+    auto put32 = [&header](int offset, u32 value) { memcpy(header + offset, &value, 4); };
+    auto put16 = [&header](int offset, u16 value) { memcpy(header + offset, &value, 2); };
+    memcpy(header, "RIFF", 4);
+    put32(4, WAV_HEADER_SIZE - 8 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(16, 16);
+    put16(20, 1); // PCM
+    put16(22, channels);
+    put32(24, sampleRate);
+    put32(28, sampleRate * blockAlign);
+    put16(32, blockAlign);
+    put16(34, 16);
+    memcpy(header + 36, "data", 4);
+    put32(40, dataSize);
+    return std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+/* the ring itself is lock-free, taking the mutex only orders the wakeup against the waiter's predicate check */
+void WavWriter::Notify(std::condition_variable& condition)
+{
+    {
+        std::lock_guard lock(mutex);
+    }
+    condition.notify_one();
+}
+
+void WavWriter::Write(const int16_t* data, std::size_t count)
+{
+    std::size_t samples = count * channels;
+    while (samples) {
+        std::size_t written = ring.Write(data, samples);
+        data += written;
+        samples -= written;
+        if (written) {
+            Notify(dataReady);
+        }
+        if (samples) {
+            std::unique_lock lock(mutex);
+            spaceReady.wait(lock, [this]() { return ring.Size() < ring.Capacity() || failed; });
+            if (failed) {
+                return;
+            }
+        }
+    }
+    frames += count;
+}
+
+void WavWriter::WriterLoop()
+{
+    std::vector<int16_t> chunk(WAV_CHUNK_SAMPLES);
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            dataReady.wait(lock, [this]() { return ring.Size() >= WAV_CHUNK_SAMPLES || closing; });
+        }
+        std::size_t count = ring.Read(chunk.data(), chunk.size());
+        if (count == 0 && closing) {
+            return;
+        }
+        Notify(spaceReady);
+        if (std::fwrite(chunk.data(), sizeof(int16_t), count, file) != count) {
+            ext::LogError("WavWriter: write failed: %s", strerror(errno));
+            std::lock_guard lock(mutex);
+            failed = true;
+            spaceReady.notify_one();
+            return;
+        }
+    }
+}
+
+bool WavWriter::Close()
+{
+    if (!file) {
+        return true;
+    }
+    {
+        std::lock_guard lock(mutex);
+        closing = true;
+    }
+    dataReady.notify_one();
+    thread.join();
+    bool ok = !failed && (raw || WriteHeader());
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+}
+
+} // namespace m8
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+#include "ring.h"
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <vector>
+
+namespace m8 {
+
+/*
+ * 16-bit PCM file written by its own thread. Write() copies into a bounded
+ * ring and only blocks while the disk is behind by more than the ring holds,
+ * so a slow disk throttles the renderer instead of dropping audio. Paths
+ * ending in .raw get no header.
+ */
+class WavWriter {
+public:
+    WavWriter(u32 sampleRate, u32 channels);
+    ~WavWriter();
+
+    bool Open(const std::string& path);
+    void Write(const int16_t* frames, std::size_t count);
+    bool Close();
+    u64 Frames() const { return frames; }
+
+private:
+    void WriterLoop();
+    bool WriteHeader();
+    void Notify(std::condition_variable& condition);
+
+    u32 sampleRate;
+    u32 channels;
+    bool raw = false;
+    std::FILE* file = nullptr;
+    SPSCRing<int16_t> ring;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable dataReady;
+    std::condition_variable spaceReady;
+    bool closing = false;
+    bool failed = false;
+    u64 frames = 0;
+};
+
+} // namespace m8